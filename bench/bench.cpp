@@ -0,0 +1,184 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../src/config.hpp"
+#include "../src/generator.hpp"
+#include "../src/utils.hpp"
+
+namespace fs = std::filesystem;
+
+struct Sample {
+    int iteration;
+    std::string phase;
+    double wall_ms;
+    long peak_rss_kb;
+    long children_rss_kb;
+    long long output_bytes;
+    bool ok;
+};
+
+static void reset_peak_rss() {
+    std::ofstream f("/proc/self/clear_refs");
+    if (f) f << "5";
+}
+
+static long read_peak_rss() {
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
+
+static long read_children_rss() {
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return ru.ru_maxrss;
+}
+
+static Sample measure(int iteration, const std::string& phase, const std::function<void()>& fn) {
+    reset_peak_rss();
+    bool ok = true;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        fn();
+    } catch (const std::exception& e) {
+        std::cerr << ":: [!] " << phase << ": " << e.what() << std::endl;
+        ok = false;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    return {iteration, phase, ms, read_peak_rss(), read_children_rss(), 0, ok};
+}
+
+static void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " -c CONFIG -k KVER [-n ITERATIONS] [-j JOBS] [-o OUTPUT] [-v]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string config_file;
+    std::string kernel_version;
+    std::string output_file = "bench_output.txt";
+    int iterations = 3;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool verbose = false;
+    utils::catch_sigpipe();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (arg == "-v") {
+            verbose = true;
+        } else if (arg == "-c" && i + 1 < argc) {
+            config_file = argv[++i];
+        } else if (arg == "-k" && i + 1 < argc) {
+            kernel_version = argv[++i];
+        } else if (arg == "-n" && i + 1 < argc) {
+            iterations = std::atoi(argv[++i]);
+        } else if (arg == "-j" && i + 1 < argc) {
+            jobs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "-o" && i + 1 < argc) {
+            output_file = argv[++i];
+        }
+    }
+    if (config_file.empty() || kernel_version.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::ofstream null_out;
+    std::streambuf* saved = std::cout.rdbuf();
+    if (!verbose) {
+        null_out.open("/dev/null");
+        std::cout.rdbuf(null_out.rdbuf());
+    }
+
+    std::vector<Sample> samples;
+    bool all_ok = true;
+    try {
+        Config cfg(config_file);
+        for (int it = 0; it < iterations; it++) {
+            fs::path image = fs::temp_directory_path() / ("nullinitrd-bench-" + std::to_string(getpid()) + ".img");
+            auto total_start = std::chrono::steady_clock::now();
+            std::unique_ptr<Generator> gen;
+            std::vector<std::pair<std::string, std::function<void()>>> phases = {
+                {"setup", [&] { gen = std::make_unique<Generator>(cfg, kernel_version, false); }},
+                {"create_structure", [&] { gen->create_structure(); }},
+                {"copy_binaries", [&] { gen->copy_binaries(); }},
+                {"copy_libraries", [&] { gen->copy_libraries(); }},
+                {"copy_modules", [&] { gen->copy_modules(); }},
+                {"create_init", [&] { gen->create_init(); }},
+                {"compile_keymap", [&] { gen->compile_keymap(); }},
+                {"run_hooks", [&] { gen->run_hooks(); }},
+                {"pack", [&] { gen->pack(image.string()); }},
+            };
+            bool ok = true;
+            for (const auto& [name, fn] : phases) {
+                samples.push_back(measure(it, name, fn));
+                if (!samples.back().ok) {
+                    ok = false;
+                    break;
+                }
+            }
+            gen.reset();
+
+            auto total_end = std::chrono::steady_clock::now();
+            Sample total = {it, "total",
+                            std::chrono::duration<double, std::milli>(total_end - total_start).count(),
+                            read_peak_rss(), read_children_rss(), 0, ok};
+            if (ok && fs::exists(image)) {
+                total.output_bytes = fs::file_size(image);
+            }
+            samples.push_back(total);
+            fs::remove(image);
+            all_ok = all_ok && ok;
+
+            Sample pipeline = measure(it, "pipeline", [&] {
+                Generator graph_gen(cfg, kernel_version, false);
+                graph_gen.build(image.string(), jobs);
+            });
+            if (pipeline.ok && fs::exists(image)) {
+                pipeline.output_bytes = fs::file_size(image);
+            }
+            samples.push_back(pipeline);
+            fs::remove(image);
+            all_ok = all_ok && pipeline.ok;
+        }
+    } catch (const std::exception& e) {
+        std::cout.rdbuf(saved);
+        std::cerr << ":: [!] " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout.rdbuf(saved);
+
+    std::ofstream out(output_file);
+    if (!out) {
+        std::cerr << ":: [!] cannot open output file: " << output_file << std::endl;
+        return 1;
+    }
+    for (const auto& s : samples) {
+        out << "iteration=" << s.iteration
+            << " phase=" << s.phase
+            << " wall_ms=" << s.wall_ms
+            << " peak_rss_kb=" << s.peak_rss_kb
+            << " children_rss_kb=" << s.children_rss_kb
+            << " output_bytes=" << s.output_bytes
+            << " status=" << (s.ok ? "ok" : "failed") << "\n";
+    }
+    std::cout << ":: results -> " << output_file << std::endl;
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#!/bin/sh
+# usage: fixture.sh DIR KVER [MODULES] [LIBS] [HOOKS]
+FIXTURE="$1"
+KVER="${2:-0.0.0-bench}"
+NMODS="${3:-3000}"
+NLIBS="${4:-8}"
+NHOOKS="${5:-8}"
+
+if [ -z "$FIXTURE" ]; then
+    echo "Error: fixture directory not set"
+    exit 1
+fi
+
+CC="${CC:-gcc}"
+MODDIR="$FIXTURE/usr/lib/modules/$KVER"
+SBIN="$FIXTURE/usr/local/sbin"
+LIBDIR="$FIXTURE/lib"
+HOOKDIR="$FIXTURE/usr/local/share/nullinitrd/hooks"
+
+rm -rf "$FIXTURE"
+mkdir -p "$MODDIR/kernel/drivers/bench" "$MODDIR/kernel/fs" "$SBIN" "$LIBDIR" "$HOOKDIR"
+
+if command -v zstd >/dev/null 2>&1; then
+    COMPRESS="zstd -q -c"; EXT=zst
+elif command -v xz >/dev/null 2>&1; then
+    COMPRESS="xz -c"; EXT=xz
+else
+    COMPRESS="gzip -c"; EXT=gz
+fi
+
+# a handful of stub sizes, compressed once and reused for every module
+for size in 8 32 128 512; do
+    head -c $((size * 1024)) /dev/urandom | od -An -tx1 | head -c $((size * 1024)) > "$FIXTURE/stub$size"
+    $COMPRESS "$FIXTURE/stub$size" > "$FIXTURE/stub$size.ko.$EXT"
+    rm "$FIXTURE/stub$size"
+done
+
+: > "$MODDIR/modules.dep"
+: > "$MODDIR/modules.alias"
+: > "$FIXTURE/modules.list"
+
+add_module() {
+    name="$1"; dir="$2"; size="$3"; dep="$4"
+    cp "$FIXTURE/stub$size.ko.$EXT" "$MODDIR/$dir/$name.ko.$EXT"
+    if [ -n "$dep" ]; then
+        echo "$dir/$name.ko.$EXT: $dep" >> "$MODDIR/modules.dep"
+    else
+        echo "$dir/$name.ko.$EXT:" >> "$MODDIR/modules.dep"
+    fi
+    echo "alias bench:$name $name" >> "$MODDIR/modules.alias"
+}
+
+for mod in nvme nvme-core ahci sd_mod sr_mod nvme-auth nvme-keyring \
+           wmi video ttm mmc_core mmc_block dm-mod dm-crypt i915 rfkill uas \
+           usb-storage idma64 cec snd raid0 raid1 raid456 md-mod; do
+    add_module "$mod" kernel/drivers/bench 128 ""
+done
+for mod in ext4 btrfs xfs vfat fat; do
+    add_module "$mod" kernel/fs 512 ""
+done
+
+i=0
+while [ $i -lt "$NMODS" ]; do
+    case $((i % 4)) in
+        0) size=8 ;; 1) size=32 ;; 2) size=128 ;; *) size=512 ;;
+    esac
+    dep=""
+    if [ $((i % 3)) -ne 0 ]; then
+        dep="kernel/drivers/bench/bench_$((i - 1)).ko.$EXT"
+    fi
+    add_module "bench_$i" kernel/drivers/bench $size "$dep"
+    if [ $((i % 2)) -eq 0 ]; then
+        echo "bench_$i" >> "$FIXTURE/modules.list"
+    fi
+    i=$((i + 1))
+done
+
+# libbench0 <- libbench1 <- ... <- libbenchN, then every binary links the top of the chain
+i=0
+prev=""
+while [ $i -lt "$NLIBS" ]; do
+    if [ -n "$prev" ]; then
+        echo "int bench$prev(void); int bench$i(void) { return bench$prev() + 1; }" > "$FIXTURE/lib$i.c"
+        "$CC" -shared -fPIC -o "$LIBDIR/libbench$i.so" "$FIXTURE/lib$i.c" \
+            -L"$LIBDIR" -lbench$prev -Wl,-rpath,"$LIBDIR"
+    else
+        echo "int bench$i(void) { return 0; }" > "$FIXTURE/lib$i.c"
+        "$CC" -shared -fPIC -o "$LIBDIR/libbench$i.so" "$FIXTURE/lib$i.c"
+    fi
+    rm "$FIXTURE/lib$i.c"
+    prev=$i
+    i=$((i + 1))
+done
+
+echo "int bench$prev(void); int main(void) { return bench$prev(); }" > "$FIXTURE/main.c"
+for bin in kmod lvm mdadm cryptsetup; do
+    "$CC" -o "$SBIN/$bin" "$FIXTURE/main.c" -L"$LIBDIR" -lbench$prev -Wl,-rpath,"$LIBDIR"
+done
+rm "$FIXTURE/main.c"
+
+i=0
+: > "$FIXTURE/hooks.list"
+while [ $i -lt "$NHOOKS" ]; do
+    cat > "$HOOKDIR/bench$i" <<EOF
+#!/bin/sh
+mkdir -p "\$NULLINITRD_WORKDIR/etc/bench$i"
+j=0
+while [ \$j -lt 32 ]; do
+    head -c 4096 /dev/zero > "\$NULLINITRD_WORKDIR/etc/bench$i/file\$j"
+    j=\$((j + 1))
+done
+EOF
+    chmod 755 "$HOOKDIR/bench$i"
+    echo "bench$i" >> "$FIXTURE/hooks.list"
+    i=$((i + 1))
+done
+
+cat > "$FIXTURE/config" <<EOF
+COMPRESSION=${BENCH_COMPRESSION:-zstd}
+ROOTFS_TYPE=ext4
+INIT_PATH=/sbin/init
+AUTODETECT_MODULES=n
+MODULES=$(tr '\n' ' ' < "$FIXTURE/modules.list")
+HOOKS=$(tr '\n' ' ' < "$FIXTURE/hooks.list")
+FEATURE_LVM=y
+FEATURE_LUKS=y
+FEATURE_MDADM=y
+EOF
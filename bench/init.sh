@@ -0,0 +1,39 @@
+#!/bin/sh
+# usage: init.sh HARNESS_BIN INIT_BIN OUTPUT [ITERATIONS]
+HARNESS="$1"
+INIT="$2"
+OUTPUT="${3:-init_bench_output.txt}"
+ITERATIONS="${4:-3}"
+
+for bin in "$HARNESS" "$INIT"; do
+    if [ ! -x "$bin" ]; then
+        echo "Error: binary not found: $bin"
+        exit 1
+    fi
+done
+
+: > "$OUTPUT"
+FAILED=0
+
+run() {
+    echo ":: scenario $1..."
+    NAME="$1"
+    shift
+    "$HARNESS" -i "$INIT" -s "$NAME" -n "$ITERATIONS" -o "$OUTPUT" "$@" || FAILED=1
+}
+
+run plain --cmdline "root=/dev/vda rootfstype=tmpfs" --device vda
+run uuid --cmdline "root=UUID=harness-root rootfstype=tmpfs" --device vda:by-uuid/harness-root
+run uuid-scan --cmdline "root=UUID=0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1f0 rootfstype=tmpfs" \
+    --ext4 vda:0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1f0
+run uuid-late --cmdline "root=UUID=harness-root rootfstype=tmpfs" --device vda:by-uuid/harness-root \
+    --device-delay 2500
+run rd-modules --cmdline "root=LABEL=root rootfstype=tmpfs rd.modules=virtio_blk,virtio_scsi,missing_mod" \
+    --device vda:by-label/root --fail-module missing_mod --modprobe-delay 5
+run resume --cmdline "root=/dev/vda rootfstype=tmpfs resume=UUID=harness-swap" \
+    --device vda --device vdb:by-uuid/harness-swap
+run resume-majmin --cmdline "root=/dev/vda rootfstype=tmpfs resume=254:1" --device vda
+run two-stage --cmdline "root=/dev/vda rootfstype=tmpfs" --device vda --two-stage
+
+echo ":: results -> $OUTPUT"
+exit $FAILED
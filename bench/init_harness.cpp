@@ -0,0 +1,391 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct Device {
+    std::string name;
+    std::string link;
+    std::string uuid;
+};
+
+struct Options {
+    std::string init_bin = "bin/init";
+    std::string scenario = "default";
+    std::string cmdline = "root=/dev/vda rootfstype=tmpfs";
+    std::string output;
+    std::vector<Device> devices;
+    std::vector<std::string> fail_modules;
+    int device_delay_ms = 0;
+    int modprobe_delay_ms = 0;
+    int timeout_s = 90;
+    int iterations = 1;
+    bool two_stage = false;
+};
+
+struct Stage {
+    const char* prefix;
+    const char* name;
+};
+
+static const Stage stages[] = {
+    {":: nullinitrd", "start"},
+    {":: loading core modules", "load_core_modules"},
+    {":: loading modules", "load_modules"},
+    {":: checking for hibernation image", "resume"},
+    {":: waiting for device", "device_wait"},
+    {":: mounting root", "mount_root"},
+    {":: switching root", "switch_root"},
+    {":: exec ", "exec"},
+};
+
+// multi-call: copied into the fake root as /usr/bin/modprobe
+static int modprobe_main(int argc, char* argv[]) {
+    const char* mod = argc > 0 ? argv[argc - 1] : "";
+    std::ofstream("/harness/modprobe.log", std::ios::app) << mod << "\n";
+
+    std::ifstream delay("/harness/modprobe.delay");
+    int ms = 0;
+    if (delay >> ms && ms > 0) usleep(ms * 1000);
+
+    std::ifstream fail("/harness/modprobe.fail");
+    std::string line;
+    while (std::getline(fail, line)) {
+        if (line == mod) return 1;
+    }
+    return 0;
+}
+
+static void write_file(const fs::path& path, const std::string& data) {
+    fs::create_directories(path.parent_path());
+    std::ofstream f(path);
+    if (!f) {
+        throw std::runtime_error("cannot write " + path.string());
+    }
+    f << data;
+}
+
+static void enter_userns() {
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNS) < 0) {
+        throw std::runtime_error(std::string("unshare failed: ") + strerror(errno));
+    }
+    write_file("/proc/self/setgroups", "deny");
+    write_file("/proc/self/uid_map", "0 " + std::to_string(uid) + " 1");
+    write_file("/proc/self/gid_map", "0 " + std::to_string(gid) + " 1");
+    if (mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) < 0) {
+        throw std::runtime_error(std::string("cannot make mounts private: ") + strerror(errno));
+    }
+}
+
+static std::string host_block_device() {
+    for (const auto& entry : fs::directory_iterator("/dev")) {
+        struct stat st;
+        if (stat(entry.path().c_str(), &st) == 0 && S_ISBLK(st.st_mode)) return entry.path();
+    }
+    return "";
+}
+
+// mknod is not allowed in a user namespace, so bind any host block device over a
+// placeholder instead; init only needs stat() to report a block device
+static void make_block_node(const fs::path& node, const std::string& host_block) {
+    if (mknod(node.c_str(), S_IFBLK | 0600, makedev(254, 0)) == 0) return;
+    write_file(node, "");
+    if (host_block.empty() || mount(host_block.c_str(), node.c_str(), nullptr, MS_BIND, nullptr) < 0) {
+        throw std::runtime_error("cannot create block device node " + node.string());
+    }
+}
+
+// just enough of an ext4 superblock for init to match UUID= without a /dev/disk link
+static std::string ext4_superblock(const std::string& uuid) {
+    std::string image(4096, '\0');
+    image[1024 + 0x38] = '\x53';
+    image[1024 + 0x39] = '\xef';
+    std::string hex;
+    for (char c : uuid) {
+        if (c != '-') hex += c;
+    }
+    for (size_t i = 0; i < 16 && 2 * i + 1 < hex.size(); i++) {
+        image[1024 + 0x68 + i] = static_cast<char>(std::stoi(hex.substr(2 * i, 2), nullptr, 16));
+    }
+    return image;
+}
+
+static fs::path build_root(const Options& opts, const std::string& self) {
+    char tmpl[] = "/tmp/nullinitrd-harness.XXXXXX";
+    char* tmp = mkdtemp(tmpl);
+    if (!tmp) {
+        throw std::runtime_error("failed to create temp directory");
+    }
+    fs::path root = tmp;
+    if (mount("tmpfs", root.c_str(), "tmpfs", 0, "mode=0755") < 0) {
+        throw std::runtime_error(std::string("tmpfs mount failed: ") + strerror(errno));
+    }
+
+    for (const char* dir : {"proc", "sys/power", "dev/disk/by-uuid", "dev/disk/by-partuuid",
+                            "dev/disk/by-label", "run", "tmp", "mnt/root", "usr/bin", "oldroot"}) {
+        fs::create_directories(root / dir);
+    }
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        fs::create_directories(root / "usr/lib/modules" / uts.release);
+    }
+    fs::copy_file(opts.init_bin, root / "init");
+    fs::copy_file(self, root / "usr/bin/modprobe");
+    chmod((root / "init").c_str(), 0755);
+    chmod((root / "usr/bin/modprobe").c_str(), 0755);
+
+    // /proc, /sys and /dev cannot be mounted by init here, so it sees these instead
+    write_file(root / "proc/cmdline", opts.cmdline + "\n");
+    write_file(root / "sys/power/resume", "");
+    write_file(root / "sys/power/resume_offset", "");
+    write_file(root / "harness/modprobe.log", "");
+    write_file(root / "harness/modprobe.delay", std::to_string(opts.modprobe_delay_ms));
+    std::string fail;
+    for (const auto& m : opts.fail_modules) fail += m + "\n";
+    write_file(root / "harness/modprobe.fail", fail);
+
+    if (opts.two_stage) {
+        write_file(root / "core/modules.order", "");
+        fs::create_directories(root / "core/payload");
+    }
+
+    int minor = 0;
+    std::string host_block = host_block_device();
+    for (const auto& dev : opts.devices) {
+        if (dev.uuid.empty()) {
+            make_block_node(root / "dev" / dev.name, host_block);
+        } else {
+            write_file(root / "dev" / dev.name, ext4_superblock(dev.uuid));
+        }
+        write_file(root / "sys/class/block" / dev.name / "dev", "254:" + std::to_string(minor++) + "\n");
+        if (!dev.link.empty() && opts.device_delay_ms == 0) {
+            fs::create_symlink("../../" + dev.name, root / "dev/disk" / dev.link);
+        }
+    }
+    return root;
+}
+
+static void link_devices(const Options& opts, const fs::path& root) {
+    for (const auto& dev : opts.devices) {
+        if (!dev.link.empty() && !fs::is_symlink(root / "dev/disk" / dev.link)) {
+            fs::create_symlink("../../" + dev.name, root / "dev/disk" / dev.link);
+        }
+    }
+}
+
+[[noreturn]] static void boot_child(const fs::path& root, int out_fd) {
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(out_fd, STDERR_FILENO);
+    close(out_fd);
+    // dropping the old root leaves no visible procfs, so init's own proc,
+    // sysfs and devtmpfs mounts fail and the fake files above stay in place
+    if (syscall(SYS_pivot_root, root.c_str(), (root / "oldroot").c_str()) < 0 ||
+        chdir("/") < 0 || umount2("/oldroot", MNT_DETACH) < 0) {
+        perror("pivot_root");
+        _exit(126);
+    }
+    rmdir("/oldroot");
+    char* argv[] = {(char*)"/init", nullptr};
+    char* envp[] = {nullptr};
+    execve("/init", argv, envp);
+    _exit(127);
+}
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static int count_lines(const fs::path& path) {
+    std::ifstream f(path);
+    std::string line;
+    int n = 0;
+    while (std::getline(f, line)) n++;
+    return n;
+}
+
+static bool run_once(const Options& opts, const std::string& self, int iteration, std::ostream& out) {
+    fs::path root = build_root(opts, self);
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    auto start = Clock::now();
+    pid_t pid = syscall(SYS_clone, CLONE_NEWPID | CLONE_NEWNS | SIGCHLD, nullptr, nullptr, nullptr, nullptr);
+    if (pid < 0) {
+        throw std::runtime_error(std::string("clone failed: ") + strerror(errno));
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        boot_child(root, fds[1]);
+    }
+    close(fds[1]);
+
+    std::string outcome = "timeout";
+    std::string buf;
+    std::string log;
+    bool linked = opts.device_delay_ms == 0;
+    bool done = false;
+    while (!done) {
+        double now = ms_since(start);
+        if (now > opts.timeout_s * 1000.0) break;
+        if (!linked && now >= opts.device_delay_ms) {
+            link_devices(opts, root);
+            linked = true;
+        }
+
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        char chunk[512];
+        ssize_t n = read(fds[0], chunk, sizeof(chunk));
+        if (n <= 0) {
+            if (outcome != "ok") outcome = "exited";
+            break;
+        }
+        buf.append(chunk, n);
+        size_t nl;
+        while ((nl = buf.find('\n')) != std::string::npos) {
+            std::string line = buf.substr(0, nl);
+            buf.erase(0, nl + 1);
+            log += line + "\n";
+            for (const auto& st : stages) {
+                if (line.compare(0, strlen(st.prefix), st.prefix) == 0) {
+                    out << "scenario=" << opts.scenario << " iteration=" << iteration
+                        << " stage=" << st.name << " t_ms=" << ms_since(start) << "\n";
+                    if (strcmp(st.name, "exec") == 0) outcome = "ok";
+                }
+            }
+            if (line.find(":: PANIC") != std::string::npos && outcome != "ok") {
+                outcome = "panic";
+            }
+            if (line.find(":: PANIC") != std::string::npos) {
+                done = true;
+            }
+        }
+    }
+    double total = ms_since(start);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    close(fds[0]);
+
+    out << "scenario=" << opts.scenario << " iteration=" << iteration
+        << " outcome=" << outcome << " total_ms=" << total
+        << " modprobe_calls=" << count_lines(root / "harness/modprobe.log") << "\n";
+    if (outcome != "ok") {
+        std::cerr << ":: [!] scenario " << opts.scenario << " iteration " << iteration
+                  << ": " << outcome << "\n" << log;
+    }
+
+    umount2(root.c_str(), MNT_DETACH);
+    rmdir(root.c_str());
+    return outcome == "ok";
+}
+
+static void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [OPTIONS]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -i, --init FILE          Static init binary (default: bin/init)" << std::endl;
+    std::cout << "  -s, --scenario NAME      Scenario name for the report" << std::endl;
+    std::cout << "      --cmdline STR        Fake /proc/cmdline" << std::endl;
+    std::cout << "      --device NAME[:LINK] Fake block device, LINK like by-uuid/ID" << std::endl;
+    std::cout << "      --ext4 NAME:UUID     Fake device with only an ext4 superblock, no link" << std::endl;
+    std::cout << "      --device-delay MS    Create device links after MS milliseconds" << std::endl;
+    std::cout << "      --fail-module NAME   Make the modprobe stub fail for NAME" << std::endl;
+    std::cout << "      --modprobe-delay MS  Delay of each modprobe stub call" << std::endl;
+    std::cout << "      --two-stage          Lay out a two-stage core image without payload" << std::endl;
+    std::cout << "      --timeout S          Per-boot timeout (default: 90)" << std::endl;
+    std::cout << "  -n ITERATIONS            Number of boots" << std::endl;
+    std::cout << "  -o FILE                  Append results to FILE" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (fs::path(argv[0]).filename() == "modprobe") {
+        return modprobe_main(argc, argv);
+    }
+
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((arg == "-i" || arg == "--init") && i + 1 < argc) {
+            opts.init_bin = argv[++i];
+        } else if ((arg == "-s" || arg == "--scenario") && i + 1 < argc) {
+            opts.scenario = argv[++i];
+        } else if (arg == "--cmdline" && i + 1 < argc) {
+            opts.cmdline = argv[++i];
+        } else if (arg == "--device" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            auto colon = spec.find(':');
+            if (colon == std::string::npos) {
+                opts.devices.push_back({spec, "", ""});
+            } else {
+                opts.devices.push_back({spec.substr(0, colon), spec.substr(colon + 1), ""});
+            }
+        } else if (arg == "--ext4" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            auto colon = spec.find(':');
+            opts.devices.push_back({spec.substr(0, colon), "", colon == std::string::npos ? "" : spec.substr(colon + 1)});
+        } else if (arg == "--device-delay" && i + 1 < argc) {
+            opts.device_delay_ms = std::atoi(argv[++i]);
+        } else if (arg == "--fail-module" && i + 1 < argc) {
+            opts.fail_modules.push_back(argv[++i]);
+        } else if (arg == "--modprobe-delay" && i + 1 < argc) {
+            opts.modprobe_delay_ms = std::atoi(argv[++i]);
+        } else if (arg == "--two-stage") {
+            opts.two_stage = true;
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            opts.timeout_s = std::atoi(argv[++i]);
+        } else if (arg == "-n" && i + 1 < argc) {
+            opts.iterations = std::atoi(argv[++i]);
+        } else if (arg == "-o" && i + 1 < argc) {
+            opts.output = argv[++i];
+        }
+    }
+
+    std::ofstream file;
+    if (!opts.output.empty()) {
+        file.open(opts.output, std::ios::app);
+        if (!file) {
+            std::cerr << ":: [!] cannot open output file: " << opts.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = opts.output.empty() ? std::cout : file;
+
+    bool all_ok = true;
+    try {
+        std::string self = fs::canonical("/proc/self/exe").string();
+        opts.init_bin = fs::canonical(opts.init_bin).string();
+        enter_userns();
+        for (int it = 0; it < opts.iterations; it++) {
+            all_ok = run_once(opts, self, it, out) && all_ok;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << ":: [!] " << e.what() << std::endl;
+        return 1;
+    }
+    return all_ok ? 0 : 1;
+}
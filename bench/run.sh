@@ -0,0 +1,33 @@
+#!/bin/sh
+# usage: run.sh BENCH_BIN OUTPUT [ITERATIONS]
+BENCH="$1"
+OUTPUT="${2:-bench_output.txt}"
+ITERATIONS="${3:-3}"
+FIXTURE="${BENCH_FIXTURE:-/tmp/nullinitrd-bench}"
+KVER="${BENCH_KVER:-0.0.0-bench}"
+
+if [ ! -x "$BENCH" ]; then
+    echo "Error: benchmark binary not found: $BENCH"
+    exit 1
+fi
+
+if ! command -v unshare >/dev/null 2>&1; then
+    echo "Error: unshare not found"
+    exit 1
+fi
+
+if [ ! -f "$FIXTURE/config" ]; then
+    echo ":: building fixture in $FIXTURE..."
+    sh "$(dirname "$0")/fixture.sh" "$FIXTURE" "$KVER" \
+        "${BENCH_MODULES:-3000}" "${BENCH_LIBS:-8}" "${BENCH_HOOKS:-8}" || exit 1
+fi
+
+# overlay the fixture over the host paths the generator reads from, inside a
+# private user+mount namespace so nothing on the host is touched
+exec unshare -rm sh -c '
+    set -e
+    mount -t overlay overlay -o lowerdir="$1/usr/lib:/usr/lib" /usr/lib
+    mount -t overlay overlay -o lowerdir="$1/usr/local/sbin:/usr/local/sbin" /usr/local/sbin
+    mount -t overlay overlay -o lowerdir="$1/usr/local/share:/usr/local/share" /usr/local/share
+    exec "$2" -c "$1/config" -k "$3" -n "$4" -o "$5"
+' sh "$FIXTURE" "$BENCH" "$KVER" "$ITERATIONS" "$OUTPUT"
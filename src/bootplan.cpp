@@ -0,0 +1,232 @@
+#include "bootplan.hpp"
+#include "elf.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+static std::string read_line(const fs::path& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+static std::string normalize(std::string name) {
+    name = name.substr(0, name.find(".ko"));
+    std::replace(name.begin(), name.end(), '-', '_');
+    return name;
+}
+
+// init has no udev and matches UUID= by reading the superblock itself, which it
+// only knows for these types; anything else is recorded by PARTUUID= or name
+static bool init_reads_uuid(const std::string& type) {
+    for (const char* known : {"ext2", "ext3", "ext4", "xfs", "btrfs", "vfat", "swap", "crypto_LUKS"}) {
+        if (type == known) return true;
+    }
+    return false;
+}
+
+static std::string device_spec(const fs::path& dev, const std::string& type) {
+    std::error_code ec;
+    fs::path real = fs::canonical(dev, ec);
+    if (ec) return dev.string();
+    for (const auto& [dir, prefix] : {std::pair<const char*, const char*>{"/dev/disk/by-uuid", "UUID="},
+                                      {"/dev/disk/by-partuuid", "PARTUUID="}}) {
+        if (!fs::is_directory(dir) || (std::string(prefix) == "UUID=" && !init_reads_uuid(type))) continue;
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            if (fs::canonical(entry.path(), ec) == real) {
+                return prefix + entry.path().filename().string();
+            }
+        }
+    }
+    return real.string();
+}
+
+BootPlan::BootPlan(const std::string& kver) : kernel_version(kver) {
+}
+
+bool BootPlan::probe() {
+    std::ifstream mounts("/proc/self/mounts");
+    std::string line, dev;
+    while (std::getline(mounts, line)) {
+        std::istringstream ss(line);
+        std::string source, target, type;
+        ss >> source >> target >> type;
+        if (target == "/" && source.compare(0, 5, "/dev/") == 0) {
+            dev = source;
+            root_type = type;
+        }
+    }
+    struct stat st;
+    if (dev.empty() || stat(dev.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+        return false;
+    }
+
+    std::error_code ec;
+    fs::path block = fs::canonical("/sys/dev/block/" + std::to_string(major(st.st_rdev)) + ":" +
+                                   std::to_string(minor(st.st_rdev)), ec);
+    if (ec) return false;
+
+    root_spec = device_spec(dev, root_type);
+    walk(block);
+    want(root_type);
+    return true;
+}
+
+void BootPlan::walk(const fs::path& block) {
+    std::vector<fs::path> below;
+    if (fs::is_directory(block / "slaves")) {
+        for (const auto& entry : fs::directory_iterator(block / "slaves")) {
+            std::error_code ec;
+            fs::path real = fs::canonical(entry.path(), ec);
+            if (!ec) below.push_back(real);
+        }
+    }
+    for (const auto& lower : below) {
+        walk(lower);
+    }
+
+    auto add_layer = [this](LayerKind kind, const std::string& name, const std::string& source) {
+        for (const auto& layer : layers) {
+            if (layer.kind == kind && layer.name == name) return;
+        }
+        layers.push_back({kind, name, source});
+    };
+
+    std::string dm_uuid = read_line(block / "dm/uuid");
+    if (dm_uuid.compare(0, 6, "CRYPT-") == 0) {
+        std::string source = below.empty() ? "" : device_spec("/dev" / below[0].filename(), "crypto_LUKS");
+        add_layer(LAYER_CRYPT, read_line(block / "dm/name"), source);
+        want("dm_mod");
+        want("dm_crypt");
+    } else if (dm_uuid.compare(0, 4, "LVM-") == 0) {
+        std::string name = read_line(block / "dm/name");
+        std::string vg;
+        for (size_t i = 0; i < name.size(); i++) {
+            if (name[i] == '-' && i + 1 < name.size() && name[i + 1] == '-') {
+                vg += '-';
+                i++;
+            } else if (name[i] == '-') {
+                break;
+            } else {
+                vg += name[i];
+            }
+        }
+        add_layer(LAYER_LVM, vg, "");
+        want("dm_mod");
+    } else if (!dm_uuid.empty()) {
+        want("dm_mod");
+    } else if (fs::exists(block / "md")) {
+        add_layer(LAYER_MD, block.filename().string(), "");
+        want("md_mod");
+        want(read_line(block / "md/level"));
+    }
+
+    if (below.empty() && dm_uuid.empty()) {
+        fs::path disk = fs::exists(block / "partition") ? block.parent_path() : block;
+        add_drivers(disk / "device");
+    }
+}
+
+void BootPlan::add_drivers(const fs::path& device) {
+    std::error_code ec;
+    fs::path dir = fs::canonical(device, ec);
+    if (ec) return;
+    for (; dir.has_relative_path() && dir != "/sys"; dir = dir.parent_path()) {
+        fs::path module = fs::canonical(dir / "driver/module", ec);
+        if (!ec) want(module.filename().string());
+    }
+}
+
+void BootPlan::want(const std::string& module) {
+    if (module.empty()) return;
+    std::string key = normalize(module);
+    if (std::find(drivers.begin(), drivers.end(), key) == drivers.end()) {
+        drivers.push_back(key);
+    }
+}
+
+void BootPlan::schedule(const fs::path& module_dir) {
+    std::map<std::string, fs::path> staged;
+    for (const auto& entry : fs::recursive_directory_iterator(module_dir)) {
+        if (entry.is_regular_file() && entry.path().string().find(".ko") != std::string::npos) {
+            staged[normalize(entry.path().filename().string())] = entry.path();
+        }
+    }
+
+    std::map<std::string, int> depth;
+    std::function<int(const std::string&)> visit = [&](const std::string& key) {
+        auto known = depth.find(key);
+        if (known != depth.end()) return known->second;
+        depth[key] = 0;
+        int level = 0;
+        for (const auto& depends : elf::modinfo(staged[key], "depends")) {
+            std::stringstream ss(depends);
+            std::string dep;
+            while (std::getline(ss, dep, ',')) {
+                dep = normalize(dep);
+                if (dep != key && staged.count(dep)) level = std::max(level, visit(dep) + 1);
+            }
+        }
+        depth[key] = level;
+        return level;
+    };
+    for (const auto& driver : drivers) {
+        if (staged.count(driver)) visit(driver);
+    }
+
+    levels.clear();
+    for (const auto& [key, level] : depth) {
+        if (levels.size() <= static_cast<size_t>(level)) levels.resize(level + 1);
+        levels[level].push_back(fs::relative(staged[key], module_dir).string());
+    }
+}
+
+void BootPlan::write(const fs::path& output) const {
+    // every count and length is a single byte in the on-disk format
+    auto check = [](size_t n, const std::string& what) {
+        if (n > 255) throw std::runtime_error(":: [!] boot plan " + what + " too large: " + std::to_string(n));
+    };
+    check(kernel_version.size(), "kernel version");
+    check(root_spec.size(), "root device");
+    check(root_type.size(), "root type");
+    check(levels.size(), "level count");
+    for (const auto& level : levels) {
+        check(level.size(), "level");
+        for (const auto& module : level) check(module.size(), "module path " + module);
+    }
+    check(layers.size(), "layer count");
+    for (const auto& layer : layers) {
+        check(layer.name.size(), "layer name");
+        check(layer.source.size(), "layer source");
+    }
+
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write boot plan: " + output.string());
+    }
+    auto put_string = [&out](const std::string& s) {
+        out.put(static_cast<char>(s.size()));
+        out.write(s.data(), s.size());
+    };
+    out.write("NBP1", 4);
+    put_string(kernel_version);
+    put_string(root_spec);
+    put_string(root_type);
+    out.put(static_cast<char>(levels.size()));
+    for (const auto& level : levels) {
+        out.put(static_cast<char>(level.size()));
+        for (const auto& module : level) put_string(module);
+    }
+    out.put(static_cast<char>(layers.size()));
+    for (const auto& layer : layers) {
+        out.put(static_cast<char>(layer.kind));
+        put_string(layer.name);
+        put_string(layer.source);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class BootPlan {
+public:
+    enum LayerKind : uint8_t { LAYER_MD = 1, LAYER_LVM = 2, LAYER_CRYPT = 3 };
+
+    struct Layer {
+        LayerKind kind;
+        std::string name;
+        std::string source;
+    };
+
+    explicit BootPlan(const std::string& kernel_version);
+
+    bool probe();
+    void schedule(const fs::path& module_dir);
+    void write(const fs::path& output) const;
+
+    const std::string& root() const { return root_spec; }
+    const std::string& fstype() const { return root_type; }
+    const std::vector<Layer>& stack() const { return layers; }
+    const std::vector<std::vector<std::string>>& module_levels() const { return levels; }
+
+private:
+    std::string kernel_version;
+    std::string root_spec;
+    std::string root_type;
+    std::vector<Layer> layers;
+    std::vector<std::string> drivers;
+    std::vector<std::vector<std::string>> levels;
+
+    void walk(const fs::path& block);
+    void add_drivers(const fs::path& device);
+    void want(const std::string& module);
+};
@@ -0,0 +1,43 @@
+#include "cache.hpp"
+#include "utils.hpp"
+#include <stdexcept>
+#include <cstdlib>
+#include <sys/stat.h>
+
+FileCache::FileCache() {
+    char tmpl[] = "/tmp/nullinitrd-cache.XXXXXX";
+    char* tmp = mkdtemp(tmpl);
+    if (!tmp) {
+        throw std::runtime_error(":: [!] failed to create cache directory");
+    }
+    cache_dir = tmp;
+}
+
+FileCache::~FileCache() {
+    std::error_code ec;
+    fs::remove_all(cache_dir, ec);
+}
+
+fs::path FileCache::decompressed(const fs::path& src, const std::string& decompress_cmd) {
+    std::string key = utils::file_digest(src) + "-" + decompress_cmd;
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = entries[key];
+        if (!slot) slot = std::make_shared<Entry>();
+        entry = slot;
+    }
+
+    std::call_once(entry->once, [&] {
+        fs::path dst = cache_dir / std::to_string(std::hash<std::string>{}(key));
+        std::string cmd = decompress_cmd + " '" + src.string() + "' > '" + dst.string() + "'";
+        if (system(cmd.c_str()) == 0) {
+            chmod(dst.c_str(), 0644);
+            entry->path = dst;
+        } else {
+            std::error_code ec;
+            fs::remove(dst, ec);
+        }
+    });
+    return entry->path;
+}
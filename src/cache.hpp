@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class FileCache {
+public:
+    FileCache();
+    ~FileCache();
+
+    fs::path decompressed(const fs::path& src, const std::string& decompress_cmd);
+
+private:
+    struct Entry {
+        std::once_flag once;
+        fs::path path;
+    };
+
+    fs::path cache_dir;
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<Entry>> entries;
+};
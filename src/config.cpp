@@ -7,6 +7,7 @@ Config::Config(const std::string& path)
     : compression("zstd"),
       rootfs_type("ext4"),
       init_path("/sbin/init"),
+      payload("none"),
       autodetect_modules(true) {
     parse_file(path);
 }
@@ -42,6 +43,18 @@ void Config::parse_file(const std::string& path) {
     rootfs_type = get("ROOTFS_TYPE", "ext4");
     init_path = get("INIT_PATH", "/sbin/init");
     autodetect_modules = get_bool("AUTODETECT_MODULES", false);
+    payload = get("PAYLOAD", "none");
+    core_modules = get_list("CORE_MODULES");
+    if (core_modules.empty()) {
+        core_modules = {"nvme", "ahci", "sd_mod", "virtio_blk", "virtio_scsi", "virtio_pci"};
+    }
+    uki_stub = get("UKI_STUB", "/usr/lib/systemd/boot/efi/linuxx64.efi.stub");
+    uki_kernel = get("UKI_KERNEL", "/boot/vmlinuz-%k");
+    uki_cmdline = get("UKI_CMDLINE");
+    uki_splash = get("UKI_SPLASH");
+    keymap = get("KEYMAP");
+    font = get("FONT");
+    trim_keep = get_list("TRIM_KEEP");
     modules = get_list("MODULES");
     hooks = get_list("HOOKS");
     for (const auto& [key, value] : config_map) {
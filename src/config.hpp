@@ -20,6 +20,15 @@ public:
     std::set<std::string> features;
     std::string rootfs_type;
     std::string init_path;
+    std::string payload;
+    std::vector<std::string> core_modules;
+    std::string uki_stub;
+    std::string uki_kernel;
+    std::string uki_cmdline;
+    std::string uki_splash;
+    std::string keymap;
+    std::string font;
+    std::vector<std::string> trim_keep;
     bool autodetect_modules;
 
 private:
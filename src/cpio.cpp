@@ -0,0 +1,104 @@
+#include "cpio.hpp"
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CpioWriter::CpioWriter(const fs::path& dir, const std::string& out, const std::string& filter)
+    : root(dir), output(out), tmp(out + ".tmp"), pipe(nullptr), next_ino(1), written(0) {
+    std::string cmd = filter + " > '" + tmp + "'";
+    pipe = popen(cmd.c_str(), "w");
+    if (!pipe) {
+        throw std::runtime_error(":: [!] failed to start compressor: " + filter);
+    }
+}
+
+CpioWriter::~CpioWriter() {
+    if (pipe) {
+        pclose(pipe);
+        std::error_code ec;
+        fs::remove(tmp, ec);
+    }
+}
+
+void CpioWriter::write_padded(const void* buf, size_t len) {
+    static const char zeros[4] = {0, 0, 0, 0};
+    fwrite(buf, 1, len, pipe);
+    written += len;
+    size_t pad = (4 - written % 4) % 4;
+    fwrite(zeros, 1, pad, pipe);
+    written += pad;
+}
+
+void CpioWriter::write_entry(const std::string& name, const struct stat& st, const std::string& data) {
+    unsigned long size = S_ISREG(st.st_mode) ? st.st_size : data.size();
+    char header[111];
+    snprintf(header, sizeof(header),
+             "070701%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX%08lX",
+             next_ino++, (unsigned long)st.st_mode, 0UL, 0UL,
+             S_ISDIR(st.st_mode) ? 2UL : 1UL, (unsigned long)st.st_mtime, size,
+             0UL, 0UL, 0UL, 0UL, (unsigned long)name.size() + 1, 0UL);
+    fwrite(header, 1, 110, pipe);
+    written += 110;
+    write_padded(name.c_str(), name.size() + 1);
+    if (!S_ISREG(st.st_mode)) {
+        write_padded(data.data(), data.size());
+    }
+}
+
+void CpioWriter::emit(const fs::path& path) {
+    std::string name = path.lexically_relative(root).string();
+    struct stat st;
+    if (lstat(path.c_str(), &st) < 0) return;
+
+    if (S_ISLNK(st.st_mode)) {
+        write_entry(name, st, fs::read_symlink(path).string());
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        write_entry(name, st, "");
+        return;
+    }
+
+    write_entry(name, st, "");
+    FILE* file = fopen(path.c_str(), "rb");
+    std::vector<char> buffer(1 << 16);
+    off_t left = st.st_size;
+    while (left > 0) {
+        size_t chunk = std::min<off_t>(left, buffer.size());
+        size_t n = file ? fread(buffer.data(), 1, chunk, file) : 0;
+        if (n < chunk) memset(buffer.data() + n, 0, chunk - n);
+        fwrite(buffer.data(), 1, chunk, pipe);
+        written += chunk;
+        left -= chunk;
+    }
+    if (file) fclose(file);
+    write_padded("", 0);
+}
+
+void CpioWriter::finish() {
+    // sorted, so the archive does not depend on which task staged what first,
+    // and parents always precede their entries
+    std::vector<fs::path> entries;
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        entries.push_back(entry.path());
+    }
+    std::sort(entries.begin(), entries.end());
+    for (const auto& path : entries) {
+        emit(path);
+    }
+
+    struct stat st = {};
+    write_entry("TRAILER!!!", st, "");
+    fflush(pipe);
+    bool broken = ferror(pipe);
+    int status = pclose(pipe);
+    pipe = nullptr;
+    if (broken || status != 0) {
+        fs::remove(tmp);
+        throw std::runtime_error(":: [!] failed to pack initramfs");
+    }
+    fs::rename(tmp, output);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <cstdio>
+#include <ctime>
+
+namespace fs = std::filesystem;
+
+class CpioWriter {
+public:
+    CpioWriter(const fs::path& root, const std::string& output, const std::string& filter);
+    ~CpioWriter();
+
+    void finish();
+
+private:
+    fs::path root;
+    std::string output;
+    std::string tmp;
+    FILE* pipe;
+    unsigned long next_ino;
+    unsigned long long written;
+
+    void emit(const fs::path& path);
+    void write_entry(const std::string& name, const struct stat& st, const std::string& data);
+    void write_padded(const void* buf, size_t len);
+};
@@ -0,0 +1,157 @@
+#include "elf.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <elf.h>
+
+namespace elf {
+
+namespace {
+
+template <typename Ehdr, typename Phdr, typename Dyn>
+void read_dynamic(std::istream& file, Info& info) {
+    Ehdr ehdr;
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(&ehdr), sizeof(ehdr))) return;
+    info.machine = ehdr.e_machine;
+
+    std::vector<Phdr> phdrs(ehdr.e_phnum);
+    file.seekg(ehdr.e_phoff);
+    if (!file.read(reinterpret_cast<char*>(phdrs.data()), phdrs.size() * sizeof(Phdr))) return;
+
+    auto vaddr_to_offset = [&phdrs](uint64_t addr) -> int64_t {
+        for (const auto& ph : phdrs) {
+            if (ph.p_type == PT_LOAD && addr >= ph.p_vaddr && addr < ph.p_vaddr + ph.p_filesz) {
+                return addr - ph.p_vaddr + ph.p_offset;
+            }
+        }
+        return -1;
+    };
+
+    std::vector<Dyn> dyns;
+    for (const auto& ph : phdrs) {
+        if (ph.p_type == PT_INTERP) {
+            std::string interp(ph.p_filesz, '\0');
+            file.seekg(ph.p_offset);
+            file.read(&interp[0], interp.size());
+            info.interpreter = interp.c_str();
+        } else if (ph.p_type == PT_DYNAMIC) {
+            dyns.resize(ph.p_filesz / sizeof(Dyn));
+            file.seekg(ph.p_offset);
+            file.read(reinterpret_cast<char*>(dyns.data()), dyns.size() * sizeof(Dyn));
+        }
+    }
+    info.valid = true;
+    if (dyns.empty()) return;
+
+    int64_t strtab = -1;
+    for (const auto& d : dyns) {
+        if (d.d_tag == DT_STRTAB) strtab = vaddr_to_offset(d.d_un.d_ptr);
+    }
+    if (strtab < 0) return;
+
+    auto read_str = [&file, strtab](uint64_t off) {
+        std::string s;
+        file.clear();
+        file.seekg(strtab + off);
+        std::getline(file, s, '\0');
+        return s;
+    };
+
+    for (const auto& d : dyns) {
+        if (d.d_tag == DT_NULL) break;
+        if (d.d_tag == DT_NEEDED) {
+            info.needed.push_back(read_str(d.d_un.d_val));
+        } else if (d.d_tag == DT_RUNPATH || d.d_tag == DT_RPATH) {
+            std::stringstream ss(read_str(d.d_un.d_val));
+            std::string dir;
+            while (std::getline(ss, dir, ':')) {
+                if (!dir.empty()) info.runpath.push_back(dir);
+            }
+        }
+    }
+}
+
+template <typename Ehdr, typename Shdr>
+std::string read_section(std::istream& file, const std::string& name) {
+    Ehdr ehdr;
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(&ehdr), sizeof(ehdr)) || ehdr.e_shoff == 0) return "";
+
+    std::vector<Shdr> shdrs(ehdr.e_shnum);
+    file.seekg(ehdr.e_shoff);
+    if (!file.read(reinterpret_cast<char*>(shdrs.data()), shdrs.size() * sizeof(Shdr))) return "";
+    if (ehdr.e_shstrndx >= shdrs.size()) return "";
+
+    const Shdr& strtab = shdrs[ehdr.e_shstrndx];
+    std::string names(strtab.sh_size, '\0');
+    file.seekg(strtab.sh_offset);
+    if (!file.read(&names[0], names.size())) return "";
+
+    for (const auto& sh : shdrs) {
+        if (sh.sh_type == SHT_NOBITS || sh.sh_name >= names.size()) continue;
+        if (name != names.c_str() + sh.sh_name) continue;
+        std::string data(sh.sh_size, '\0');
+        file.seekg(sh.sh_offset);
+        if (!file.read(&data[0], data.size())) return "";
+        return data;
+    }
+    return "";
+}
+
+}
+
+Info read(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return Info();
+    return read(file);
+}
+
+Info read(std::istream& file) {
+    Info info;
+    unsigned char ident[EI_NIDENT];
+    if (!file.read(reinterpret_cast<char*>(ident), sizeof(ident))) return info;
+    if (memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_DATA] != ELFDATA2LSB) return info;
+
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        info.is64 = true;
+        read_dynamic<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(file, info);
+    } else if (ident[EI_CLASS] == ELFCLASS32) {
+        read_dynamic<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(file, info);
+    }
+    return info;
+}
+
+std::vector<std::string> modinfo(const fs::path& path, const std::string& key) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return {};
+    return modinfo(file, key);
+}
+
+std::vector<std::string> modinfo(std::istream& file, const std::string& key) {
+    std::vector<std::string> values;
+    unsigned char ident[EI_NIDENT];
+    if (!file.read(reinterpret_cast<char*>(ident), sizeof(ident))) return values;
+    if (memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_DATA] != ELFDATA2LSB) return values;
+
+    std::string section;
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        section = read_section<Elf64_Ehdr, Elf64_Shdr>(file, ".modinfo");
+    } else if (ident[EI_CLASS] == ELFCLASS32) {
+        section = read_section<Elf32_Ehdr, Elf32_Shdr>(file, ".modinfo");
+    }
+
+    std::string prefix = key + "=";
+    size_t pos = 0;
+    while (pos < section.size()) {
+        size_t end = section.find('\0', pos);
+        if (end == std::string::npos) end = section.size();
+        if (section.compare(pos, prefix.size(), prefix) == 0) {
+            values.push_back(section.substr(pos + prefix.size(), end - pos - prefix.size()));
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+
+namespace fs = std::filesystem;
+
+namespace elf {
+    struct Info {
+        bool valid = false;
+        bool is64 = false;
+        uint16_t machine = 0;
+        std::string interpreter;
+        std::vector<std::string> needed;
+        std::vector<std::string> runpath;
+    };
+
+    Info read(const fs::path& path);
+    Info read(std::istream& file);
+    std::vector<std::string> modinfo(const fs::path& path, const std::string& key);
+    std::vector<std::string> modinfo(std::istream& file, const std::string& key);
+}
@@ -0,0 +1,157 @@
+#include "font.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+
+static uint32_t le32(const std::string& data, size_t pos) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()) + pos;
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+ConsoleFont::ConsoleFont(const std::vector<fs::path>& dirs) : roots(dirs), width(0), height(0), count(0) {
+}
+
+fs::path ConsoleFont::find_font(const std::string& name) const {
+    for (const auto& root : roots) {
+        for (const char* ext : {".psfu", ".psf", ""}) {
+            for (const char* comp : {"", ".gz", ".xz", ".zst", ".bz2"}) {
+                fs::path candidate = root / (name + ext + comp);
+                if (fs::is_regular_file(candidate)) return candidate;
+            }
+        }
+    }
+    return "";
+}
+
+std::string ConsoleFont::read_font(const fs::path& path) const {
+    std::string ext = path.extension().string();
+    std::string data;
+    if (ext == ".gz" || ext == ".xz" || ext == ".zst" || ext == ".bz2") {
+        std::string tool = ext == ".gz" ? "gzip" : ext == ".xz" ? "xz" : ext == ".zst" ? "zstd" : "bzip2";
+        std::string cmd = tool + " -d -c '" + path.string() + "' 2>/dev/null";
+        FILE* pipe = popen(cmd.c_str(), "r");
+        if (pipe) {
+            char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) data.append(buffer, n);
+            pclose(pipe);
+        }
+    } else {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        data = ss.str();
+    }
+    return data;
+}
+
+void ConsoleFont::load(const std::string& name) {
+    fs::path path = name.find('/') != std::string::npos ? fs::path(name) : find_font(name);
+    if (path.empty() || !fs::is_regular_file(path)) {
+        throw std::runtime_error(":: [!] console font not found: " + name);
+    }
+    std::string data = read_font(path);
+    if (data.size() >= 4 && data.compare(0, 2, "\x36\x04") == 0) {
+        parse_psf1(data);
+    } else if (data.size() >= 32 && data.compare(0, 4, "\x72\xb5\x4a\x86") == 0) {
+        parse_psf2(data);
+    } else {
+        throw std::runtime_error(":: [!] not a PSF console font: " + path.string());
+    }
+}
+
+// The kernel takes glyphs padded to 32 rows, whatever the font height.
+void ConsoleFont::set_glyphs(const std::string& data, size_t offset, unsigned charsize) {
+    unsigned row = (width + 7) / 8;
+    if (count == 0 || count > 512 || height == 0 || height > 32 || width == 0 || width > 32 ||
+        charsize != row * height) {
+        throw std::runtime_error(":: [!] unsupported console font size " + std::to_string(width) + "x" +
+                                 std::to_string(height) + " with " + std::to_string(count) + " glyphs");
+    }
+    if (data.size() < offset + static_cast<size_t>(count) * charsize) {
+        throw std::runtime_error(":: [!] truncated console font");
+    }
+    glyphs.assign(static_cast<size_t>(count) * 32 * row, 0);
+    for (unsigned glyph = 0; glyph < count; glyph++) {
+        data.copy(reinterpret_cast<char*>(&glyphs[glyph * 32 * row]), charsize, offset + glyph * charsize);
+    }
+}
+
+// PSF1 unicode table: per glyph, 16-bit values up to 0xffff; 0xfffe starts
+// the combining sequences, which the kernel cannot map.
+void ConsoleFont::parse_psf1(const std::string& data) {
+    unsigned mode = static_cast<unsigned char>(data[2]);
+    width = 8;
+    height = static_cast<unsigned char>(data[3]);
+    count = mode & 0x01 ? 512 : 256;
+    set_glyphs(data, 4, height);
+    if (!(mode & 0x06)) return;
+
+    size_t pos = 4 + static_cast<size_t>(count) * height;
+    for (unsigned glyph = 0; glyph < count && pos + 2 <= data.size(); glyph++) {
+        bool sequence = false;
+        while (pos + 2 <= data.size()) {
+            uint16_t value = static_cast<unsigned char>(data[pos]) | static_cast<unsigned char>(data[pos + 1]) << 8;
+            pos += 2;
+            if (value == 0xffff) break;
+            if (value == 0xfffe) sequence = true;
+            if (!sequence) unicode.emplace_back(value, glyph);
+        }
+    }
+}
+
+// PSF2 unicode table: per glyph, UTF-8 characters up to 0xff; 0xfe starts
+// the combining sequences. Only the basic plane fits the kernel's table.
+void ConsoleFont::parse_psf2(const std::string& data) {
+    size_t header = le32(data, 8);
+    uint32_t flags = le32(data, 12);
+    count = le32(data, 16);
+    unsigned charsize = le32(data, 20);
+    height = le32(data, 24);
+    width = le32(data, 28);
+    set_glyphs(data, header, charsize);
+    if (!(flags & 0x01)) return;
+
+    size_t pos = header + static_cast<size_t>(count) * charsize;
+    for (unsigned glyph = 0; glyph < count && pos < data.size(); glyph++) {
+        bool sequence = false;
+        while (pos < data.size()) {
+            unsigned char c = data[pos++];
+            if (c == 0xff) break;
+            if (c == 0xfe) {
+                sequence = true;
+                continue;
+            }
+            int more = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+            uint32_t value = more ? c & (0x3f >> more) : c;
+            for (; more > 0 && pos < data.size(); more--) {
+                value = value << 6 | (static_cast<unsigned char>(data[pos++]) & 0x3f);
+            }
+            if (!sequence && value < 0xfffe) unicode.emplace_back(value, glyph);
+        }
+    }
+}
+
+void ConsoleFont::write(const fs::path& output) const {
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write console font: " + output.string());
+    }
+    auto put16 = [&out](uint16_t value) {
+        char bytes[2] = {static_cast<char>(value & 0xff), static_cast<char>(value >> 8)};
+        out.write(bytes, 2);
+    };
+    out.write("NKF1", 4);
+    put16(width);
+    put16(height);
+    put16(count);
+    out.write(reinterpret_cast<const char*>(glyphs.data()), glyphs.size());
+    size_t entries = std::min<size_t>(unicode.size(), 0xffff);
+    put16(entries);
+    for (size_t i = 0; i < entries; i++) {
+        put16(unicode[i].first);
+        put16(unicode[i].second);
+    }
+}
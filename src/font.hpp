@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class ConsoleFont {
+public:
+    explicit ConsoleFont(const std::vector<fs::path>& roots);
+
+    void load(const std::string& name);
+    void write(const fs::path& output) const;
+    unsigned glyph_count() const { return count; }
+    size_t unicode_count() const { return unicode.size(); }
+
+private:
+    std::vector<fs::path> roots;
+    unsigned width;
+    unsigned height;
+    unsigned count;
+    std::vector<unsigned char> glyphs;
+    std::vector<std::pair<uint16_t, uint16_t>> unicode;
+
+    fs::path find_font(const std::string& name) const;
+    std::string read_font(const fs::path& path) const;
+    void parse_psf1(const std::string& data);
+    void parse_psf2(const std::string& data);
+    void set_glyphs(const std::string& data, size_t offset, unsigned charsize);
+};
@@ -1,14 +1,32 @@
 #include "generator.hpp"
 #include "hooks.hpp"
+#include "cpio.hpp"
+#include "elf.hpp"
+#include "tasks.hpp"
+#include "report.hpp"
+#include "uki.hpp"
+#include "keymap.hpp"
+#include "font.hpp"
+#include "bootplan.hpp"
 #include <filesystem>
 #include <iostream>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <map>
+#include <memory>
 #include <cstdlib>
+#include <fnmatch.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-Generator::Generator(const Config& cfg, const std::string& kernel_ver, bool v)
-    : config(cfg), kernel_version(kernel_ver), verbose(v) {
+static thread_local Report::Origin current_origin = {"other", "", ""};
+
+Generator::Generator(const Config& cfg, const std::string& kernel_ver, bool v,
+                     const fs::path& root, FileCache* cache)
+    : config(cfg), kernel_version(kernel_ver), verbose(v), sysroot(root), file_cache(cache),
+      trimming(false) {
     char tmpl[] = "/tmp/nullinitrd.XXXXXX";
     char* tmp = mkdtemp(tmpl);
     if (!tmp) {
@@ -16,8 +34,13 @@ Generator::Generator(const Config& cfg, const std::string& kernel_ver, bool v)
     }
     chmod(tmp, 0755);
     work_dir = tmp;
-    create_structure();
-    create_symlinks();
+    try {
+        create_structure();
+        create_symlinks();
+    } catch (...) {
+        remove_work_dirs();
+        throw;
+    }
     default_modules = {
         "nvme", "nvme-core", "ahci", "sd_mod", "sr_mod", "nvme-auth", "nvme-keyring",
         "ext4", "btrfs", "xfs", "vfat", "fat", "wmi", "video", "ttm", "mmc_core", "mmc_block",
@@ -26,6 +49,17 @@ Generator::Generator(const Config& cfg, const std::string& kernel_ver, bool v)
     };
 }
 
+Generator::~Generator() {
+    remove_work_dirs();
+}
+
+void Generator::remove_work_dirs() {
+    std::error_code ec;
+    for (const char* suffix : {"", ".core", ".payload", ".payload.cpio"}) {
+        fs::remove_all(work_dir.string() + suffix, ec);
+    }
+}
+
 void Generator::create_directory(const fs::path& path) {
     if (verbose) {
         std::cout << ":: creating dir: " << path << std::endl;
@@ -65,16 +99,52 @@ void Generator::create_symlinks() {
     safe_symlink("usr/lib64", work_dir / "lib64");
 }
 
-void Generator::copy_file(const fs::path& src, const fs::path& dst) {
+void Generator::copy_file(const fs::path& src, const fs::path& dst, mode_t mode) {
     if (verbose) {
         std::cout << ":: copying " << src << " -> " << dst << std::endl;
     }
     fs::create_directories(dst.parent_path());
-    fs::copy_file(src, dst, fs::copy_options::overwrite_existing);
+    fs::path real_src = sysroot.resolve(src);
+    fs::copy_file(real_src, dst, fs::copy_options::overwrite_existing);
     struct stat st;
-    if (stat(src.c_str(), &st) == 0) {
+    if (mode) {
+        chmod(dst.c_str(), mode);
+    } else if (stat(real_src.c_str(), &st) == 0) {
         chmod(dst.c_str(), st.st_mode);
     }
+    stage(dst);
+}
+
+void Generator::stage(const fs::path& path) {
+    if (report) {
+        report->record(path, current_origin);
+    }
+}
+
+void Generator::enable_report(const std::string& path) {
+    report_path = path;
+    report = std::make_unique<Report>();
+}
+
+void Generator::enable_uki(const std::string& path) {
+    uki_path = path;
+}
+
+void Generator::enable_cpio_list(const std::string& path) {
+    if (config.payload != "none") {
+        throw std::runtime_error(":: [!] a cpio list cannot be written for two-stage images");
+    }
+    cpio_list_path = path;
+}
+
+void Generator::run_hook(HookManager& hooks, const std::string& hook) {
+    if (!report) {
+        hooks.run_hook(hook);
+        return;
+    }
+    auto before = report->snapshot(work_dir);
+    hooks.run_hook(hook);
+    report->record_changes(work_dir, before, {"hook", hook, ""});
 }
 
 std::string Generator::find_binary(const std::string& name) {
@@ -84,8 +154,8 @@ std::string Generator::find_binary(const std::string& name) {
         "/sbin", "/bin"
     };
     for (const auto& path : paths) {
-        fs::path full_path = fs::path(path) / name;
-        if (fs::exists(full_path)) {
+        fs::path full_path = sysroot.path(path) / name;
+        if (fs::exists(sysroot.resolve(full_path))) {
             return full_path.string();
         }
     }
@@ -93,6 +163,9 @@ std::string Generator::find_binary(const std::string& name) {
 }
 
 std::vector<std::string> Generator::get_dependencies(const std::string& binary) {
+    if (!sysroot.is_host()) {
+        return sysroot.get_dependencies(binary);
+    }
     std::vector<std::string> deps;
     std::string cmd = "ldd " + binary + " 2>/dev/null";
     FILE* pipe = popen(cmd.c_str(), "r");
@@ -124,14 +197,21 @@ std::vector<std::string> Generator::get_dependencies(const std::string& binary)
 }
 
 fs::path Generator::get_lib_destination_path(const fs::path& lib_src) {
-    if (lib_src.string().find("/lib64") != std::string::npos ||
-        lib_src.string().find("/x86_64") != std::string::npos) {
+    std::string target = "/" + lib_src.lexically_relative(sysroot.dir()).string();
+    if (target.find("/lib64") != std::string::npos ||
+        target.find("/x86_64") != std::string::npos) {
         return work_dir / "usr/lib64" / lib_src.filename();
     }
     return work_dir / "usr/lib" / lib_src.filename();
 }
 
+bool Generator::claim(std::set<std::string>& seen, const std::string& key) {
+    std::lock_guard<std::mutex> lock(claim_mutex);
+    return seen.insert(key).second;
+}
+
 void Generator::copy_binary_with_deps(const std::string& binary) {
+    current_origin = {"binary", binary, ""};
     std::string bin_path = find_binary(binary);
     if (bin_path.empty()) {
         if (verbose) {
@@ -145,45 +225,118 @@ void Generator::copy_binary_with_deps(const std::string& binary) {
     copy_file(src, dst);
 
     auto deps = get_dependencies(bin_path);
+    // A library another binary already copied is still staged for this one,
+    // so the report knows every binary that needs it.
     for (const auto& dep : deps) {
-        if (copied_libs.count(dep) > 0) continue;
-        copied_libs.insert(dep);
         fs::path lib_src(dep);
-        if (!fs::exists(lib_src)) continue;
+        fs::path real_lib = sysroot.resolve(lib_src);
+        if (!fs::exists(real_lib)) continue;
         fs::path lib_dst = get_lib_destination_path(lib_src);
-        copy_file(lib_src, lib_dst);
-        if (fs::is_symlink(lib_src)) {
-            auto target = fs::read_symlink(lib_src);
-            auto real_lib = lib_src.parent_path() / target;
-            if (fs::exists(real_lib) && copied_libs.count(real_lib.string()) == 0) {
-                copied_libs.insert(real_lib.string());
-                copy_file(real_lib, lib_dst.parent_path() / target.filename());
+        if (claim(copied_libs, dep)) {
+            copy_file(lib_src, lib_dst);
+        } else {
+            stage(lib_dst);
+        }
+        if (real_lib.filename() != lib_src.filename()) {
+            fs::path real_dst = lib_dst.parent_path() / real_lib.filename();
+            if (claim(copied_libs, real_lib.string())) {
+                copy_file(real_lib, real_dst);
+            } else {
+                stage(real_dst);
             }
         }
     }
 }
 
-void Generator::copy_binaries() {
-    std::cout << ":: copying binaries..." << std::endl;
+std::vector<std::string> Generator::required_binaries(const Config& cfg) {
+    std::vector<std::string> binaries = {"kmod"};
+    if (cfg.is_enabled("LVM")) {
+        binaries.push_back("lvm");
+    }
+    if (cfg.is_enabled("MDADM")) {
+        binaries.push_back("mdadm");
+    }
+    if (cfg.is_enabled("LUKS")) {
+        binaries.push_back("cryptsetup");
+    }
+    return binaries;
+}
 
-    copy_binary_with_deps("kmod");
-    fs::path kmod_dst = work_dir / "usr/bin/kmod";
-    if (fs::exists(kmod_dst)) {
-        fs::create_symlink("kmod", work_dir / "usr/bin/modprobe");
-        fs::create_symlink("kmod", work_dir / "usr/bin/insmod");
-        fs::create_symlink("kmod", work_dir / "usr/bin/rmmod");
-        fs::create_symlink("kmod", work_dir / "usr/bin/lsmod");
-        fs::create_symlink("kmod", work_dir / "usr/bin/depmod");
+void Generator::enable_trim(const std::vector<std::string>& profiles) {
+    std::vector<std::string> requests;
+    for (const auto& profile : profiles) {
+        std::ifstream in(profile);
+        if (!in) {
+            throw std::runtime_error(":: [!] cannot read usage profile: " + profile);
+        }
+        std::string kind, name;
+        while (in >> kind >> name) {
+            std::replace(name.begin(), name.end(), '-', '_');
+            if (kind == "module") {
+                used_modules.insert(name);
+            } else if (kind == "request") {
+                requests.push_back(name);
+            } else if (kind == "exec") {
+                used_binaries.insert(fs::path(name).filename().string());
+            }
+        }
     }
 
-    if (config.is_enabled("LVM")) {
-        copy_binary_with_deps("lvm");
+    std::ifstream aliases(sysroot.resolve(sysroot.path("/usr/lib/modules/" + kernel_version + "/modules.alias")));
+    std::string line;
+    std::vector<std::pair<std::string, std::string>> alias_list;
+    while (std::getline(aliases, line)) {
+        std::stringstream ss(line);
+        std::string keyword, pattern, module;
+        if (ss >> keyword >> pattern >> module && keyword == "alias") {
+            std::replace(pattern.begin(), pattern.end(), '-', '_');
+            alias_list.emplace_back(pattern, module);
+        }
     }
-    if (config.is_enabled("MDADM")) {
-        copy_binary_with_deps("mdadm");
+    for (const auto& request : requests) {
+        if (std::all_of(request.begin(), request.end(), [](char c) { return isalnum(c) || c == '_'; })) {
+            used_modules.insert(request);
+        }
+        for (const auto& [pattern, module] : alias_list) {
+            if (fnmatch(pattern.c_str(), request.c_str(), 0) == 0) used_modules.insert(module);
+        }
+    }
+    trimming = true;
+    std::cout << ":: trimming to " << used_modules.size() << " module(s) from " << profiles.size()
+              << " usage profile(s)" << std::endl;
+}
+
+std::vector<std::string> Generator::binaries_to_copy() {
+    std::vector<std::string> binaries;
+    for (const auto& binary : required_binaries(config)) {
+        bool keep = !trimming || binary == "kmod" || used_binaries.count(binary) ||
+                    std::find(config.trim_keep.begin(), config.trim_keep.end(), binary) != config.trim_keep.end();
+        if (keep) {
+            binaries.push_back(binary);
+        } else if (verbose) {
+            std::cout << ":: trimmed unused binary " << binary << std::endl;
+        }
+    }
+    return binaries;
+}
+
+void Generator::copy_binaries() {
+    std::cout << ":: copying binaries..." << std::endl;
+
+    for (const auto& binary : binaries_to_copy()) {
+        copy_binary_with_deps(binary);
     }
-    if (config.is_enabled("LUKS")) {
-        copy_binary_with_deps("cryptsetup");
+    create_kmod_links();
+}
+
+void Generator::create_kmod_links() {
+    current_origin = {"binary", "kmod", ""};
+    fs::path kmod_dst = work_dir / "usr/bin/kmod";
+    if (fs::exists(kmod_dst)) {
+        for (const char* link : {"modprobe", "insmod", "rmmod", "lsmod", "depmod"}) {
+            fs::create_symlink("kmod", work_dir / "usr/bin" / link);
+            stage(work_dir / "usr/bin" / link);
+        }
     }
 }
 
@@ -212,8 +365,12 @@ std::vector<std::string> Generator::detect_modules() {
     return modules;
 }
 
-void Generator::copy_module(const std::string& module) {
-    std::string mod_path = "/usr/lib/modules/" + kernel_version;
+void Generator::copy_module(const std::string& module, const std::string& reason) {
+    std::string key = module;
+    std::replace(key.begin(), key.end(), '-', '_');
+    if (!claim(copied_modules, key)) return;
+
+    std::string mod_path = sysroot.resolve(sysroot.path("/usr/lib/modules/" + kernel_version)).string();
     std::string mod_name = module;
     std::replace(mod_name.begin(), mod_name.end(), '_', '-');
 
@@ -252,66 +409,209 @@ void Generator::copy_module(const std::string& module) {
 
             fs::path dst = work_dir / "usr/lib/modules" / kernel_version / dst_path;
             fs::create_directories(dst.parent_path());
+            current_origin = {"module", module, reason};
             if (needs_decompress) {
                 if (verbose) {
                     std::cout << ":: decompressing " << src << " -> " << dst << std::endl;
                 }
-                std::string full_cmd = decompress_cmd + " '" + mod_file + "' > '" + dst.string() + "'";
-                system(full_cmd.c_str());
+                bool ok;
+                if (file_cache) {
+                    fs::path cached = file_cache->decompressed(mod_file, decompress_cmd);
+                    ok = !cached.empty();
+                    if (ok) fs::copy_file(cached, dst, fs::copy_options::overwrite_existing);
+                } else {
+                    std::string full_cmd = decompress_cmd + " '" + mod_file + "' > '" + dst.string() + "'";
+                    ok = system(full_cmd.c_str()) == 0;
+                }
+                if (!ok) {
+                    pclose(pipe);
+                    throw std::runtime_error(":: [!] failed to decompress module: " + mod_file);
+                }
                 chmod(dst.c_str(), 0644);
+                stage(dst);
             } else {
                 copy_file(src, dst);
             }
+            copy_firmware(dst);
+
+            for (const auto& depends : elf::modinfo(dst, "depends")) {
+                std::stringstream ss(depends);
+                std::string dep;
+                while (std::getline(ss, dep, ',')) {
+                    if (!dep.empty()) copy_module(dep, "dependency:" + module);
+                }
+            }
         }
     }
     pclose(pipe);
 }
 
-void Generator::copy_modules() {
-    std::cout << ":: copying kernel modules..." << std::endl;
-    create_directory(work_dir / "usr/lib/modules" / kernel_version);
+void Generator::copy_firmware(const fs::path& module) {
+    for (const auto& name : elf::modinfo(module, "firmware")) {
+        if (!claim(copied_firmware, name)) continue;
+        if (!copy_firmware_file(name) && verbose) {
+            std::cout << ":: firmware not found: " << name << std::endl;
+        }
+    }
+}
 
-    std::vector<std::string> modules_to_copy;
+bool Generator::copy_firmware_file(const std::string& name) {
+    fs::path base = sysroot.resolve(sysroot.path("/usr/lib/firmware"));
+    if (!fs::is_directory(base)) {
+        base = sysroot.resolve(sysroot.path("/lib/firmware"));
+    }
+    const std::vector<std::string> dirs = {"updates/" + kernel_version, "updates", kernel_version, ""};
+    fs::path dst_base = work_dir / "usr/lib/firmware";
+
+    for (const char* suffix : {"", ".zst", ".xz"}) {
+        for (const auto& dir : dirs) {
+            fs::path rel = (fs::path(dir) / (name + suffix)).lexically_normal();
+            fs::path parent = sysroot.resolve((base / rel).parent_path());
+            fs::path src = parent / rel.filename();
+            fs::path real = sysroot.resolve(src);
+            if (!fs::is_regular_file(real)) continue;
+
+            fs::path dst = dst_base / rel;
+            fs::path target = real.lexically_relative(base);
+            if (fs::is_symlink(src) && !target.empty() && *target.begin() != "..") {
+                fs::path target_dst = dst_base / target;
+                if (claim(copied_firmware, target_dst.string())) {
+                    fs::create_directories(target_dst.parent_path());
+                    copy_file(real, target_dst);
+                }
+                if (claim(copied_firmware, dst.string())) {
+                    fs::create_directories(dst.parent_path());
+                    std::error_code ec;
+                    fs::remove(dst, ec);
+                    fs::create_symlink(target_dst.lexically_relative(dst.parent_path()), dst);
+                    stage(dst);
+                }
+            } else if (claim(copied_firmware, dst.string())) {
+                fs::create_directories(dst.parent_path());
+                copy_file(real, dst);
+            }
+            if (verbose) {
+                std::cout << ":: firmware " << rel.string() << std::endl;
+            }
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (config.autodetect_modules) {
-        auto detected = detect_modules();
-        modules_to_copy.insert(modules_to_copy.end(), detected.begin(), detected.end());
+std::vector<std::pair<std::string, std::string>> Generator::modules_to_copy() {
+    std::vector<std::pair<std::string, std::string>> wanted;
+
+    if (trimming) {
+        for (const auto& mod : used_modules) {
+            wanted.emplace_back(mod, "profile");
+        }
+        for (const auto& mod : config.trim_keep) {
+            wanted.emplace_back(mod, "TRIM_KEEP");
+        }
+        wanted.emplace_back(config.rootfs_type, "TRIM_KEEP");
+    } else {
+        if (config.autodetect_modules && sysroot.is_host()) {
+            for (const auto& mod : detect_modules()) {
+                wanted.emplace_back(mod, "autodetect");
+            }
+        }
+        for (const auto& mod : default_modules) {
+            wanted.emplace_back(mod, "default");
+        }
+    }
+    for (const auto& mod : config.modules) {
+        wanted.emplace_back(mod, "MODULES");
+    }
+    if (config.is_enabled("IMAGEROOT")) {
+        for (const char* mod : {"loop", "squashfs", "erofs", "overlay"}) {
+            wanted.emplace_back(mod, "FEATURE_IMAGEROOT");
+        }
+    }
+    if (config.payload != "none") {
+        wanted.emplace_back("loop", "payload");
+        wanted.emplace_back(config.payload, "payload");
+        for (const auto& mod : config.core_modules) {
+            wanted.emplace_back(mod, "CORE_MODULES");
+        }
     }
 
-    modules_to_copy.insert(modules_to_copy.end(), default_modules.begin(), default_modules.end());
-    modules_to_copy.insert(modules_to_copy.end(), config.modules.begin(), config.modules.end());
+    std::vector<std::pair<std::string, std::string>> unique;
+    std::set<std::string> seen;
+    for (const auto& entry : wanted) {
+        std::string key = entry.first;
+        std::replace(key.begin(), key.end(), '-', '_');
+        if (seen.insert(key).second) unique.push_back(entry);
+    }
+    return unique;
+}
 
-    for (const auto& mod : modules_to_copy) {
-        copy_module(mod);
+void Generator::copy_modules() {
+    std::cout << ":: copying kernel modules..." << std::endl;
+    create_directory(work_dir / "usr/lib/modules" / kernel_version);
+
+    for (const auto& [mod, reason] : modules_to_copy()) {
+        copy_module(mod, reason);
     }
+    generate_module_deps();
+    write_boot_plan();
+}
 
+void Generator::generate_module_deps() {
     std::cout << ":: generating module dependencies..." << std::endl;
+    current_origin = {"depmod", "", ""};
     std::string depmod_cmd = "depmod -b " + work_dir.string() + " " + kernel_version;
     if (system(depmod_cmd.c_str()) != 0) {
         std::cerr << ":: [!] depmod failed, falling back to copying modules.dep" << std::endl;
-        std::string dep_src = "/usr/lib/modules/" + kernel_version + "/modules.dep";
+        fs::path dep_src = sysroot.path("/usr/lib/modules/" + kernel_version + "/modules.dep");
         if (fs::exists(dep_src)) {
             copy_file(dep_src, work_dir / "usr/lib/modules" / kernel_version / "modules.dep");
         }
-        std::string alias_src = "/usr/lib/modules/" + kernel_version + "/modules.alias";
+        fs::path alias_src = sysroot.path("/usr/lib/modules/" + kernel_version + "/modules.alias");
         if (fs::exists(alias_src)) {
             copy_file(alias_src, work_dir / "usr/lib/modules" / kernel_version / "modules.alias");
         }
     }
+    for (const auto& entry : fs::directory_iterator(work_dir / "usr/lib/modules" / kernel_version)) {
+        if (entry.path().filename().string().compare(0, 8, "modules.") == 0) {
+            stage(entry.path());
+        }
+    }
+}
+
+void Generator::write_boot_plan() {
+    if (!config.autodetect_modules || !sysroot.is_host() || config.payload != "none") {
+        return;
+    }
+    current_origin = {"bootplan", "", ""};
+    BootPlan plan(kernel_version);
+    if (!plan.probe()) {
+        std::cerr << ":: [!] root device not found, skipping boot plan" << std::endl;
+        return;
+    }
+    plan.schedule(work_dir / "usr/lib/modules" / kernel_version);
+    plan.write(work_dir / "etc/bootplan.bin");
+    stage(work_dir / "etc/bootplan.bin");
+    if (verbose) {
+        std::cout << ":: boot plan: root=" << plan.root() << " (" << plan.fstype() << "), "
+                  << plan.module_levels().size() << " module level(s), " << plan.stack().size()
+                  << " storage layer(s)" << std::endl;
+    }
 }
 
 void Generator::create_init() {
     std::cout << ":: installing init..." << std::endl;
+    current_origin = {"init", "", ""};
 
-    std::vector<std::string> init_paths = {
-        "/usr/share/nullinitrd/init",
-        "/usr/local/share/nullinitrd/init",
+    std::vector<fs::path> init_paths = {
+        sysroot.path("/usr/share/nullinitrd/init"),
+        sysroot.path("/usr/local/share/nullinitrd/init"),
         "./bin/init"
     };
 
     fs::path init_src;
     for (const auto& p : init_paths) {
-        if (fs::exists(p)) {
+        if (fs::exists(sysroot.resolve(p))) {
             init_src = p;
             break;
         }
@@ -322,15 +622,92 @@ void Generator::create_init() {
     }
 
     fs::path init_dst = work_dir / "init";
-    copy_file(init_src, init_dst);
-    chmod(init_dst.c_str(), 0755);
+    copy_file(init_src, init_dst, 0755);
+}
+
+void Generator::compile_keymap() {
+    std::string name = config.keymap;
+    if (name.empty()) {
+        std::ifstream vconsole(sysroot.resolve(sysroot.path("/etc/vconsole.conf")));
+        std::string line;
+        while (std::getline(vconsole, line)) {
+            if (line.compare(0, 7, "KEYMAP=") == 0) {
+                name = line.substr(7);
+                name.erase(std::remove(name.begin(), name.end(), '"'), name.end());
+            }
+        }
+    }
+    if (name.empty()) {
+        return;
+    }
+    std::cout << ":: compiling keymap " << name << "..." << std::endl;
+    current_origin = {"keymap", name, ""};
+
+    std::vector<fs::path> dirs;
+    for (const char* dir : {"/usr/share/kbd/keymaps", "/usr/share/keymaps", "/usr/lib/kbd/keymaps"}) {
+        dirs.push_back(sysroot.resolve(sysroot.path(dir)));
+    }
+    Keymap keymap(dirs);
+    try {
+        keymap.load(name);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << ", keeping the kernel keymap" << std::endl;
+        return;
+    }
+    for (const auto& warning : keymap.warnings()) {
+        if (verbose) std::cerr << ":: [!] keymap: " << warning << std::endl;
+    }
+    create_directory(work_dir / "etc");
+    keymap.write(work_dir / "etc/keymap.bin");
+    stage(work_dir / "etc/keymap.bin");
+    if (verbose) {
+        std::cout << ":: keymap has " << keymap.entry_count() << " entries" << std::endl;
+    }
+}
+
+void Generator::compile_font() {
+    std::string name = config.font;
+    if (name.empty()) {
+        std::ifstream vconsole(sysroot.resolve(sysroot.path("/etc/vconsole.conf")));
+        std::string line;
+        while (std::getline(vconsole, line)) {
+            if (line.compare(0, 5, "FONT=") == 0) {
+                name = line.substr(5);
+                name.erase(std::remove(name.begin(), name.end(), '"'), name.end());
+            }
+        }
+    }
+    if (name.empty()) {
+        return;
+    }
+    std::cout << ":: compiling console font " << name << "..." << std::endl;
+    current_origin = {"font", name, ""};
+
+    std::vector<fs::path> dirs;
+    for (const char* dir : {"/usr/share/kbd/consolefonts", "/usr/share/consolefonts", "/usr/lib/kbd/consolefonts"}) {
+        dirs.push_back(sysroot.resolve(sysroot.path(dir)));
+    }
+    ConsoleFont font(dirs);
+    try {
+        font.load(name);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << ", keeping the kernel font" << std::endl;
+        return;
+    }
+    create_directory(work_dir / "etc");
+    font.write(work_dir / "etc/font.bin");
+    stage(work_dir / "etc/font.bin");
+    if (verbose) {
+        std::cout << ":: console font has " << font.glyph_count() << " glyphs, "
+                  << font.unicode_count() << " unicode entries" << std::endl;
+    }
 }
 
 void Generator::run_hooks() {
     std::cout << ":: running hooks..." << std::endl;
-    HookManager hook_mgr(config, work_dir, kernel_version, verbose);
+    HookManager hook_mgr(config, work_dir, kernel_version, verbose, sysroot.dir());
     for (const auto& hook : config.hooks) {
-        hook_mgr.run_hook(hook);
+        run_hook(hook_mgr, hook);
     }
 }
 
@@ -345,14 +722,264 @@ std::string Generator::get_compression_cmd() {
     return "zstd -19 -T0";
 }
 
+void Generator::write_archive(const fs::path& dir, const std::string& output, const std::string& filter) {
+    CpioWriter writer(dir, output, filter);
+    writer.finish();
+}
+
+static std::string module_key(const fs::path& path) {
+    std::string name = path.filename().string();
+    name = name.substr(0, name.find(".ko"));
+    std::replace(name.begin(), name.end(), '-', '_');
+    return name;
+}
+
+std::vector<fs::path> Generator::core_module_order() {
+    fs::path mod_dir = work_dir / "usr/lib/modules" / kernel_version;
+    std::map<std::string, fs::path> staged;
+    for (const auto& entry : fs::recursive_directory_iterator(mod_dir)) {
+        if (entry.is_regular_file() && entry.path().string().find(".ko") != std::string::npos) {
+            staged[module_key(entry.path())] = entry.path();
+        }
+    }
+
+    std::map<std::string, std::vector<std::string>> deps;
+    std::ifstream dep_file(mod_dir / "modules.dep");
+    std::string line;
+    while (std::getline(dep_file, line)) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::stringstream ss(line.substr(colon + 1));
+        std::string dep;
+        auto& list = deps[module_key(line.substr(0, colon))];
+        while (ss >> dep) list.push_back(module_key(dep));
+    }
+
+    std::vector<fs::path> order;
+    std::set<std::string> visited;
+    std::function<void(const std::string&)> visit = [&](const std::string& name) {
+        if (!visited.insert(name).second) return;
+        for (const auto& dep : deps[name]) visit(dep);
+        auto it = staged.find(name);
+        if (it != staged.end()) order.push_back(it->second);
+    };
+
+    std::vector<std::string> wanted = {"loop", config.payload, config.rootfs_type};
+    wanted.insert(wanted.end(), config.core_modules.begin(), config.core_modules.end());
+    for (const auto& mod : wanted) {
+        visit(module_key(mod));
+    }
+    return order;
+}
+
+void Generator::build_payload(const fs::path& image) {
+    std::string cmd;
+    if (config.payload == "erofs") {
+        cmd = "mkfs.erofs -zlz4hc -T0 --all-root '" + image.string() + "' '" + work_dir.string() + "'";
+    } else if (config.payload == "squashfs") {
+        std::string comp = config.compression;
+        if (comp == "bzip2" || comp == "lzma") comp = "xz";
+        if (comp == "none") comp = "gzip";
+        cmd = "mksquashfs '" + work_dir.string() + "' '" + image.string() +
+              "' -noappend -all-root -quiet -comp " + comp;
+    } else {
+        throw std::runtime_error(":: [!] unknown payload type: " + config.payload);
+    }
+    if (verbose) {
+        std::cout << ":: " << cmd << std::endl;
+    }
+    if (system((cmd + " >/dev/null").c_str()) != 0) {
+        throw std::runtime_error(":: [!] failed to build " + config.payload + " payload");
+    }
+}
+
+void Generator::pack_two_stage(const std::string& output) {
+    std::cout << ":: packing two-stage initramfs (" << config.payload << " payload)..." << std::endl;
+    fs::path core_dir = work_dir.string() + ".core";
+    fs::path payload_dir = work_dir.string() + ".payload";
+    for (const char* dir : {"usr/bin", "usr/lib", "usr/lib64", "etc", "dev", "sys", "proc",
+                            "run", "tmp", "mnt/root", "core/modules", "core/payload"}) {
+        fs::create_directories(core_dir / dir);
+    }
+    fs::create_symlink("usr/bin", core_dir / "bin");
+    fs::create_symlink("usr/bin", core_dir / "sbin");
+    fs::create_symlink("usr/lib", core_dir / "lib");
+    fs::create_symlink("usr/lib64", core_dir / "lib64");
+    fs::rename(work_dir / "init", core_dir / "init");
+    // init applies the keymap and font before the payload is mounted
+    for (const char* file : {"etc/keymap.bin", "etc/font.bin"}) {
+        if (fs::exists(work_dir / file)) {
+            fs::rename(work_dir / file, core_dir / file);
+        }
+    }
+
+    std::ofstream order_file(core_dir / "core/modules.order");
+    for (const auto& mod : core_module_order()) {
+        copy_file(mod, core_dir / "core/modules" / mod.filename());
+        order_file << mod.filename().string() << "\n";
+        // core drivers load before the payload is mounted, so their firmware has to be in the core
+        for (const auto& name : elf::modinfo(mod, "firmware")) {
+            for (const auto& dir : {"updates/" + kernel_version, std::string("updates"), kernel_version, std::string()}) {
+                for (const char* suffix : {"", ".zst", ".xz"}) {
+                    fs::path rel = (fs::path(dir) / (name + suffix)).lexically_normal();
+                    if (fs::is_regular_file(work_dir / "usr/lib/firmware" / rel)) {
+                        copy_file(work_dir / "usr/lib/firmware" / rel, core_dir / "usr/lib/firmware" / rel);
+                    }
+                }
+            }
+        }
+    }
+    order_file.close();
+
+    fs::create_directories(payload_dir / "core");
+    build_payload(payload_dir / "core/payload.img");
+
+    // the payload is already compressed, so it goes first as a plain cpio segment
+    fs::path segment = work_dir.string() + ".payload.cpio";
+    write_archive(payload_dir, segment, "cat");
+    write_archive(core_dir, output, "{ cat '" + segment.string() + "' && " + get_compression_cmd() + "; }");
+    remove_work_dirs();
+}
+
 void Generator::pack(const std::string& output) {
+    if (config.payload != "none") {
+        if (report) report->collect(work_dir, get_compression_cmd(), 1);
+        pack_two_stage(output);
+        if (report) report->write(report_path, fs::file_size(output));
+        if (!uki_path.empty()) write_uki(output);
+        return;
+    }
     std::cout << ":: packing initramfs..." << std::endl;
-    std::string cpio_cmd = "cd " + work_dir.string() + " && find . | cpio -o -H newc 2>/dev/null";
-    std::string compress_cmd = get_compression_cmd();
-    std::string full_cmd = cpio_cmd + " | " + compress_cmd + " > " + output;
-    int ret = system(full_cmd.c_str());
-    if (ret != 0) {
-        throw std::runtime_error(":: [!] failed to pack initramfs");
-    }
-    fs::remove_all(work_dir);
+    write_archive(work_dir, output, get_compression_cmd());
+    if (report) report->collect(work_dir, get_compression_cmd(), 1);
+    release_tree();
+    if (report) report->write(report_path, fs::file_size(output));
+    if (!uki_path.empty()) write_uki(output);
+}
+
+void Generator::build(const std::string& output, int jobs) {
+    std::cout << ":: building with " << jobs << " job(s)..." << std::endl;
+
+    TaskGraph graph;
+    std::vector<TaskGraph::Id> binaries;
+    for (const auto& binary : binaries_to_copy()) {
+        binaries.push_back(graph.add([this, binary] { copy_binary_with_deps(binary); }));
+    }
+    graph.add([this] { create_kmod_links(); }, binaries);
+
+    create_directory(work_dir / "usr/lib/modules" / kernel_version);
+    std::vector<TaskGraph::Id> modules;
+    for (const auto& [mod, reason] : modules_to_copy()) {
+        modules.push_back(graph.add([this, mod = mod, reason = reason] { copy_module(mod, reason); }));
+    }
+    TaskGraph::Id depmod = graph.add([this] { generate_module_deps(); }, modules);
+    graph.add([this] { write_boot_plan(); }, {depmod});
+    graph.add([this] { create_init(); });
+    bool keyboard = std::find(config.hooks.begin(), config.hooks.end(), "keyboard") != config.hooks.end();
+    if (!config.keymap.empty() || keyboard) {
+        graph.add([this] { compile_keymap(); });
+    }
+    if (!config.font.empty() || keyboard) {
+        graph.add([this] { compile_font(); });
+    }
+
+    HookManager hook_mgr(config, work_dir, kernel_version, verbose, sysroot.dir());
+    std::vector<TaskGraph::Id> previous;
+    for (const auto& hook : config.hooks) {
+        previous = {graph.add([this, &hook_mgr, hook] { run_hook(hook_mgr, hook); }, previous)};
+    }
+
+    graph.run(jobs);
+
+    if (config.payload == "none") {
+        std::cout << ":: packing initramfs..." << std::endl;
+        write_archive(work_dir, output, get_compression_cmd());
+        if (report) report->collect(work_dir, get_compression_cmd(), jobs);
+        release_tree();
+    } else {
+        if (report) report->collect(work_dir, get_compression_cmd(), jobs);
+        pack_two_stage(output);
+    }
+    if (report) report->write(report_path, fs::file_size(output));
+    if (!uki_path.empty()) write_uki(output);
+}
+
+void Generator::release_tree() {
+    if (cpio_list_path.empty()) {
+        fs::remove_all(work_dir);
+    } else {
+        write_cpio_list();
+    }
+}
+
+void Generator::write_cpio_list() {
+    fs::path tree = cpio_list_path + ".d";
+    fs::remove_all(tree);
+    std::error_code ec;
+    fs::rename(work_dir, tree, ec);
+    if (ec) {
+        fs::copy(work_dir, tree, fs::copy_options::recursive | fs::copy_options::copy_symlinks);
+        fs::remove_all(work_dir);
+    }
+    tree = fs::absolute(tree);
+
+    std::ofstream out(cpio_list_path);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write cpio list: " + cpio_list_path);
+    }
+    out << "# nullinitrd " << kernel_version << ", for CONFIG_INITRAMFS_SOURCE\n";
+    std::vector<fs::path> entries;
+    for (const auto& entry : fs::recursive_directory_iterator(tree)) {
+        entries.push_back(entry.path());
+    }
+    std::sort(entries.begin(), entries.end());
+    for (const auto& path : entries) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) < 0) continue;
+        std::string name = "/" + path.lexically_relative(tree).string();
+        char mode[8];
+        snprintf(mode, sizeof(mode), "%o", st.st_mode & 07777);
+        if (S_ISDIR(st.st_mode)) {
+            out << "dir " << name << " " << mode << " 0 0\n";
+        } else if (S_ISLNK(st.st_mode)) {
+            out << "slink " << name << " " << fs::read_symlink(path).string() << " " << mode << " 0 0\n";
+        } else if (S_ISREG(st.st_mode)) {
+            out << "file " << name << " " << path.string() << " " << mode << " 0 0\n";
+        }
+    }
+    std::cout << ":: cpio list -> " << cpio_list_path << " (files in " << tree.string() << ")" << std::endl;
+}
+
+void Generator::write_uki(const std::string& initrd) {
+    std::cout << ":: assembling unified kernel image..." << std::endl;
+    std::string kernel = config.uki_kernel;
+    size_t k = kernel.find("%k");
+    if (k != std::string::npos) kernel.replace(k, 2, kernel_version);
+
+    UkiWriter uki(sysroot.resolve(sysroot.path(config.uki_stub)));
+    for (const char* osrel : {"/etc/os-release", "/usr/lib/os-release"}) {
+        fs::path path = sysroot.resolve(sysroot.path(osrel));
+        if (fs::is_regular_file(path)) {
+            uki.add_file(".osrel", path);
+            break;
+        }
+    }
+
+    std::string cmdline = config.uki_cmdline;
+    fs::path cmdline_file = sysroot.resolve(sysroot.path("/etc/kernel/cmdline"));
+    if (cmdline.empty() && fs::is_regular_file(cmdline_file)) {
+        std::ifstream in(cmdline_file);
+        std::getline(in, cmdline);
+    }
+    if (!cmdline.empty()) {
+        uki.add_section(".cmdline", cmdline);
+    }
+    if (!config.uki_splash.empty()) {
+        uki.add_file(".splash", sysroot.resolve(sysroot.path(config.uki_splash)));
+    }
+    uki.add_section(".uname", kernel_version);
+    uki.add_file(".initrd", initrd);
+    uki.add_file(".linux", sysroot.resolve(sysroot.path(kernel)));
+    uki.write(uki_path);
+    std::cout << ":: unified kernel image -> " << uki_path << std::endl;
 }
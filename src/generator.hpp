@@ -4,38 +4,87 @@
 #include <vector>
 #include <set>
 #include <filesystem>
+#include <mutex>
+#include <memory>
+#include <sys/types.h>
 #include "config.hpp"
+#include "sysroot.hpp"
+#include "cache.hpp"
+#include "report.hpp"
+
+class HookManager;
 
 namespace fs = std::filesystem;
 
 class Generator {
 public:
-    Generator(const Config& cfg, const std::string& kernel_ver, bool verbose);
+    Generator(const Config& cfg, const std::string& kernel_ver, bool verbose,
+              const fs::path& root = "/", FileCache* cache = nullptr);
+    ~Generator();
 
     void create_structure();
     void copy_binaries();
     void copy_libraries();
     void copy_modules();
     void create_init();
+    void compile_keymap();
+    void compile_font();
     void run_hooks();
     void pack(const std::string& output);
+    void build(const std::string& output, int jobs);
+    void enable_report(const std::string& path);
+    void enable_uki(const std::string& path);
+    void enable_cpio_list(const std::string& path);
+    void enable_trim(const std::vector<std::string>& profiles);
+
+    static std::vector<std::string> required_binaries(const Config& cfg);
 
 private:
     const Config& config;
     std::string kernel_version;
     bool verbose;
+    Sysroot sysroot;
+    FileCache* file_cache;
+    std::unique_ptr<Report> report;
+    std::string report_path;
+    std::string uki_path;
+    std::string cpio_list_path;
+    bool trimming;
+    std::set<std::string> used_modules;
+    std::set<std::string> used_binaries;
     fs::path work_dir;
     std::set<std::string> copied_libs;
+    std::set<std::string> copied_firmware;
+    std::set<std::string> copied_modules;
+    std::mutex claim_mutex;
     std::vector<std::string> default_modules;
 
     void create_directory(const fs::path& path);
     void create_symlinks();
-    void copy_file(const fs::path& src, const fs::path& dst);
+    void copy_file(const fs::path& src, const fs::path& dst, mode_t mode = 0);
+    void stage(const fs::path& path);
+    bool claim(std::set<std::string>& seen, const std::string& key);
+    void create_kmod_links();
+    std::vector<std::string> binaries_to_copy();
+    std::vector<std::pair<std::string, std::string>> modules_to_copy();
+    void run_hook(HookManager& hooks, const std::string& hook);
+    void generate_module_deps();
+    void write_boot_plan();
     std::string find_binary(const std::string& name);
     std::vector<std::string> get_dependencies(const std::string& binary);
     void copy_binary_with_deps(const std::string& binary);
     std::vector<std::string> detect_modules();
-    void copy_module(const std::string& module);
+    void copy_module(const std::string& module, const std::string& reason);
+    void copy_firmware(const fs::path& module);
+    bool copy_firmware_file(const std::string& name);
     std::string get_compression_cmd();
+    void write_archive(const fs::path& dir, const std::string& output, const std::string& filter);
+    std::vector<fs::path> core_module_order();
+    void build_payload(const fs::path& image);
+    void pack_two_stage(const std::string& output);
+    void release_tree();
+    void remove_work_dirs();
+    void write_cpio_list();
+    void write_uki(const std::string& initrd);
     fs::path get_lib_destination_path(const fs::path& lib_src);
 };
\ No newline at end of file
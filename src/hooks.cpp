@@ -3,13 +3,14 @@
 #include <cstdlib>
 #include <sys/stat.h>
 HookManager::HookManager(const Config& cfg, const fs::path& work,
-                         const std::string& kver, bool v)
-    : config(cfg), work_dir(work), kernel_version(kver), verbose(v) {}
+                         const std::string& kver, bool v, const fs::path& r)
+    : config(cfg), work_dir(work), kernel_version(kver), verbose(v), root(r) {}
 
 void HookManager::run_script(const fs::path& script) {
     std::cout << ":: [#] " << script << std::endl;
     std::string cmd = "NULLINITRD_WORKDIR=" + work_dir.string() + 
                      " NULLINITRD_KERNEL=" + kernel_version +
+                     " NULLINITRD_ROOT=" + root.string() +
                      " " + script.string();
     
     int ret = system(cmd.c_str());
@@ -26,7 +27,7 @@ bool HookManager::find_and_run(const std::string& hook_name) {
     };
     
     for (const auto& path : search_paths) {
-        fs::path hook_path = fs::path(path) / hook_name;
+        fs::path hook_path = root / fs::path(path).relative_path() / hook_name;
         if (fs::exists(hook_path)) {
             struct stat st;
             if (stat(hook_path.c_str(), &st) == 0 && (st.st_mode & S_IXUSR)) {
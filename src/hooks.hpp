@@ -8,7 +8,7 @@ namespace fs = std::filesystem;
 class HookManager {
 public:
     HookManager(const Config& cfg, const fs::path& work, 
-                const std::string& kver, bool verbose);
+                const std::string& kver, bool verbose, const fs::path& root = "/");
     
     void run_hook(const std::string& hook_name);
     
@@ -17,6 +17,7 @@ private:
     fs::path work_dir;
     std::string kernel_version;
     bool verbose;
+    fs::path root;
     
     void run_script(const fs::path& script);
     bool find_and_run(const std::string& hook_name);
@@ -0,0 +1,329 @@
+#include "image.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+class ImageReader::Input {
+public:
+    explicit Input(int fd) : fd(fd), buffer(1 << 16), start(0), end(0), total(0) {}
+
+    size_t read(char* buf, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            if (start == end && !fill()) break;
+            size_t n = std::min(len - done, end - start);
+            memcpy(buf + done, buffer.data() + start, n);
+            start += n;
+            done += n;
+        }
+        total += done;
+        return done;
+    }
+
+    bool skip(uint64_t len) {
+        while (len > 0) {
+            if (start == end && !fill()) return false;
+            size_t n = std::min<uint64_t>(len, end - start);
+            start += n;
+            total += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    int peek() {
+        if (start == end && !fill()) return -1;
+        return static_cast<unsigned char>(buffer[start]);
+    }
+
+    void align() {
+        skip((4 - total % 4) % 4);
+    }
+
+    uint64_t consumed() const { return total; }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t start;
+    size_t end;
+    uint64_t total;
+
+    bool fill() {
+        ssize_t n;
+        do {
+            n = ::read(fd, buffer.data(), buffer.size());
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        start = 0;
+        end = n;
+        return true;
+    }
+};
+
+ImageReader::ImageReader(const std::string& image) : path(image), fd(-1) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(":: [!] cannot open image: " + path);
+    }
+}
+
+ImageReader::~ImageReader() {
+    if (fd >= 0) close(fd);
+}
+
+std::string ImageReader::detect(const unsigned char* buf, size_t len) {
+    if (len >= 6 && (memcmp(buf, "070701", 6) == 0 || memcmp(buf, "070702", 6) == 0)) return "none";
+    if (len >= 2 && buf[0] == 0x1f && (buf[1] == 0x8b || buf[1] == 0x9e)) return "gzip";
+    if (len >= 6 && memcmp(buf, "\xfd" "7zXZ\0", 6) == 0) return "xz";
+    if (len >= 4 && memcmp(buf, "\x28\xb5\x2f\xfd", 4) == 0) return "zstd";
+    if (len >= 3 && memcmp(buf, "BZh", 3) == 0) return "bzip2";
+    if (len >= 4 && memcmp(buf, "\x02\x21\x4c\x18", 4) == 0) return "lz4";
+    if (len >= 3 && buf[0] == 0x5d && buf[1] == 0x00 && buf[2] == 0x00) return "lzma";
+    return "";
+}
+
+static uint64_t hex_field(const char* header, int index) {
+    char field[9];
+    memcpy(field, header + 6 + index * 8, 8);
+    field[8] = '\0';
+    return std::strtoull(field, nullptr, 16);
+}
+
+void ImageReader::parse_archive(Input& in, const Visitor& visit) {
+    while (true) {
+        char header[110];
+        if (in.read(header, sizeof(header)) != sizeof(header)) {
+            throw std::runtime_error(":: [!] truncated cpio header in " + path);
+        }
+        if (memcmp(header, "070701", 6) != 0 && memcmp(header, "070702", 6) != 0) {
+            throw std::runtime_error(":: [!] bad cpio magic in " + path);
+        }
+
+        Entry entry;
+        entry.mode = hex_field(header, 1);
+        entry.mtime = hex_field(header, 5);
+        entry.size = hex_field(header, 6);
+        entry.segment = found.size() - 1;
+        uint64_t namesize = hex_field(header, 11);
+        if (namesize == 0 || namesize > 4096) {
+            throw std::runtime_error(":: [!] bad cpio name size in " + path);
+        }
+        std::string name(namesize, '\0');
+        if (in.read(&name[0], namesize) != namesize) {
+            throw std::runtime_error(":: [!] truncated cpio entry in " + path);
+        }
+        name.resize(strlen(name.c_str()));
+        in.align();
+        if (name == "TRAILER!!!") return;
+
+        while (name.compare(0, 2, "./") == 0) name.erase(0, 2);
+        entry.name = name;
+        uint64_t left = entry.size;
+        if (S_ISLNK(entry.mode)) {
+            entry.target.resize(left);
+            if (in.read(&entry.target[0], left) != left) {
+                throw std::runtime_error(":: [!] truncated cpio entry in " + path);
+            }
+            left = 0;
+        }
+
+        Reader read = [&in, &left](char* buf, size_t len) -> size_t {
+            size_t n = in.read(buf, std::min<uint64_t>(len, left));
+            left -= n;
+            return n;
+        };
+        if (name != ".") visit(entry, read);
+        if (!in.skip(left)) {
+            throw std::runtime_error(":: [!] truncated cpio data in " + path);
+        }
+        in.align();
+    }
+}
+
+size_t ImageReader::read_at(uint64_t offset, void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, static_cast<char*>(buf) + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static uint32_t le32(const unsigned char* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint32_t crc32(const unsigned char* p, size_t len) {
+    uint32_t crc = 0xffffffff;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// Walks the frame and block headers; consecutive frames belong to the same segment.
+uint64_t ImageReader::zstd_end(uint64_t pos) {
+    static const int dict_size[] = {0, 1, 2, 4};
+    static const int content_size[] = {0, 2, 4, 8};
+    bool framed = false;
+    while (true) {
+        unsigned char h[8];
+        size_t n = read_at(pos, h, sizeof(h));
+        if (n < 4) break;
+        uint32_t magic = le32(h);
+        if ((magic & 0xfffffff0) == 0x184d2a50 && framed) {
+            if (n < 8) return 0;
+            pos += 8 + static_cast<uint64_t>(le32(h + 4));
+            continue;
+        }
+        if (magic != 0xfd2fb528 || n < 5) break;
+        unsigned desc = h[4];
+        bool single = desc & 0x20;
+        pos += 5 + (single ? 0 : 1) + dict_size[desc & 3] +
+               ((desc >> 6) == 0 ? (single ? 1 : 0) : content_size[desc >> 6]);
+        bool last = false;
+        while (!last) {
+            unsigned char b[3];
+            if (read_at(pos, b, sizeof(b)) != sizeof(b)) return 0;
+            uint32_t block = b[0] | b[1] << 8 | b[2] << 16;
+            unsigned type = (block >> 1) & 3;
+            if (type == 3) return 0;
+            last = block & 1;
+            pos += 3 + (type == 1 ? 1 : block >> 3);
+        }
+        if (desc & 0x04) pos += 4;
+        framed = true;
+    }
+    struct stat st;
+    if (!framed || fstat(fd, &st) < 0 || pos > static_cast<uint64_t>(st.st_size)) return 0;
+    return pos;
+}
+
+// Finds the stream footer: 4-byte aligned, "YZ" magic, flags matching the
+// header, a valid CRC and a backward size pointing at an index indicator.
+uint64_t ImageReader::xz_end(uint64_t pos) {
+    unsigned char header[12];
+    if (read_at(pos, header, sizeof(header)) != sizeof(header)) return 0;
+    std::vector<unsigned char> chunk(1 << 16);
+    uint64_t chunk_start = 0;
+    size_t chunk_len = 0;
+    for (uint64_t footer = pos + 24;; footer += 4) {
+        if (footer + 12 > chunk_start + chunk_len) {
+            chunk_start = footer;
+            chunk_len = read_at(chunk_start, chunk.data(), chunk.size());
+            if (chunk_len < 12) return 0;
+        }
+        const unsigned char* f = chunk.data() + (footer - chunk_start);
+        if (f[10] != 'Y' || f[11] != 'Z' || memcmp(f + 8, header + 6, 2) != 0) continue;
+        if (crc32(f + 4, 6) != le32(f)) continue;
+        uint64_t index_size = (static_cast<uint64_t>(le32(f + 4)) + 1) * 4;
+        if (index_size > footer - pos - 12) continue;
+        unsigned char indicator;
+        if (read_at(footer - index_size, &indicator, 1) != 1 || indicator != 0) continue;
+        return footer + 12;
+    }
+}
+
+// Where a compressed segment ends, for the formats whose framing records it;
+// 0 when unknown, in which case the segment runs to the end of the image.
+uint64_t ImageReader::segment_end(uint64_t offset, const std::string& compression) {
+    if (compression == "zstd") return zstd_end(offset);
+    if (compression == "xz") return xz_end(offset);
+    return 0;
+}
+
+void ImageReader::scan_compressed(uint64_t offset, uint64_t end, const std::string& compression,
+                                  const Visitor& visit) {
+    std::string cmd = (compression == "lzma" ? "xz --format=lzma" : compression) + " -d -c -q";
+    if (end > offset) cmd = "head -c " + std::to_string(end - offset) + " | " + cmd;
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        throw std::runtime_error(":: [!] cannot create pipe");
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        int src = open(path.c_str(), O_RDONLY);
+        if (src < 0 || lseek(src, offset, SEEK_SET) < 0) _exit(1);
+        dup2(src, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(out[1]);
+    if (pid < 0) {
+        close(out[0]);
+        throw std::runtime_error(":: [!] cannot start " + compression);
+    }
+
+    Input in(out[0]);
+    try {
+        int c;
+        while ((c = in.peek()) >= 0) {
+            if (c == 0) {
+                in.skip(1);
+                continue;
+            }
+            parse_archive(in, visit);
+        }
+    } catch (...) {
+        close(out[0]);
+        waitpid(pid, nullptr, 0);
+        throw;
+    }
+    close(out[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || in.consumed() == 0) {
+        throw std::runtime_error(":: [!] failed to decompress " + compression + " segment at offset " +
+                                 std::to_string(offset));
+    }
+}
+
+void ImageReader::scan(const Visitor& visit) {
+    found.clear();
+    uint64_t offset = 0;
+    while (true) {
+        if (lseek(fd, offset, SEEK_SET) < 0) break;
+        Input in(fd);
+        int c;
+        while ((c = in.peek()) == 0) {
+            in.skip(1);
+        }
+        if (c < 0) break;
+        offset += in.consumed();
+
+        unsigned char magic[8];
+        lseek(fd, offset, SEEK_SET);
+        ssize_t n = ::read(fd, magic, sizeof(magic));
+        std::string compression = detect(magic, n > 0 ? n : 0);
+        if (compression.empty()) {
+            throw std::runtime_error(":: [!] unknown segment format at offset " + std::to_string(offset));
+        }
+        found.push_back({offset, compression});
+
+        if (compression != "none") {
+            uint64_t end = segment_end(offset, compression);
+            scan_compressed(offset, end, compression, visit);
+            if (end == 0) break;
+            offset = end;
+            continue;
+        }
+        lseek(fd, offset, SEEK_SET);
+        Input raw(fd);
+        parse_archive(raw, visit);
+        offset += raw.consumed();
+    }
+    if (found.empty()) {
+        throw std::runtime_error(":: [!] empty image: " + path);
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+
+class ImageReader {
+public:
+    struct Segment {
+        uint64_t offset;
+        std::string compression;
+    };
+
+    struct Entry {
+        std::string name;
+        mode_t mode;
+        uint64_t size;
+        long mtime;
+        std::string target;
+        size_t segment;
+    };
+
+    using Reader = std::function<size_t(char* buf, size_t len)>;
+    using Visitor = std::function<void(const Entry& entry, const Reader& read)>;
+
+    explicit ImageReader(const std::string& path);
+    ~ImageReader();
+
+    void scan(const Visitor& visit);
+    const std::vector<Segment>& segments() const { return found; }
+
+    static std::string detect(const unsigned char* buf, size_t len);
+
+private:
+    class Input;
+
+    std::string path;
+    int fd;
+    std::vector<Segment> found;
+
+    void parse_archive(Input& in, const Visitor& visit);
+    size_t read_at(uint64_t offset, void* buf, size_t len);
+    uint64_t zstd_end(uint64_t pos);
+    uint64_t xz_end(uint64_t pos);
+    uint64_t segment_end(uint64_t offset, const std::string& compression);
+    void scan_compressed(uint64_t offset, uint64_t end, const std::string& compression, const Visitor& visit);
+};
@@ -2,16 +2,32 @@
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <cstdint>
+#include <climits>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <sys/utsname.h>
 #include <sys/reboot.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <linux/fiemap.h>
+#include <linux/kd.h>
+#include <linux/loop.h>
 #include <linux/reboot.h>
 
+#ifndef FS_IOC_FIEMAP
+#define FS_IOC_FIEMAP _IOWR('f', 11, struct fiemap)
+#endif
+#ifndef FIBMAP
+#define FIBMAP _IO(0x00, 1)
+#define FIGETBSZ _IO(0x00, 2)
+#endif
+
 #define MSG(x) write(STDOUT_FILENO, x, sizeof(x) - 1)
 #define ERR(x) write(STDERR_FILENO, x, sizeof(x) - 1)
 
@@ -19,9 +35,20 @@ static char cmdline[4096];
 static char root_dev[256] = "/dev/sda1";
 static char root_type[32] = "ext4";
 static char root_flags[256] = "ro";
+static char root_image[256] = "";
+static bool to_ram = false;
+static bool root_overlay = false;
 static char init_path[256] = "/sbin/init";
+static char resume_dev[256] = "";
+static char resume_offset[32] = "";
 static int root_delay = 0;
+static bool noresume = false;
+static int payload_mode = -1;
+static bool payload_mounted = false;
 static bool verbose = false;
+static bool readahead_enabled = true;
+static bool root_given = false;
+static bool root_type_given = false;
 
 static char modules_to_load[4096] = "";
 
@@ -29,6 +56,10 @@ static void print_str(const char *s) {
     write(STDOUT_FILENO, s, strlen(s));
 }
 
+static void print_err(const char *s) {
+    write(STDERR_FILENO, s, strlen(s));
+}
+
 static void print_num(int n) {
     char buf[16];
     snprintf(buf, sizeof(buf), "%d", n);
@@ -53,7 +84,55 @@ static void do_mount(const char *src, const char *tgt, const char *type, unsigne
     }
 }
 
+static void record_usage(const char *kind, const char *name) {
+    int fd = open("/run/nullinitrd/usage", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%s %s\n", kind, name);
+    write(fd, line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+    close(fd);
+}
+
+static char modprobe_helper[256] = "";
+
+static void hook_modprobe() {
+    int fd = open("/proc/sys/kernel/modprobe", O_RDWR | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, modprobe_helper, sizeof(modprobe_helper) - 1);
+    if (n > 0 && lseek(fd, 0, SEEK_SET) == 0 && write(fd, "/init\n", 6) == 6) {
+        modprobe_helper[n] = '\0';
+    } else {
+        modprobe_helper[0] = '\0';
+    }
+    close(fd);
+}
+
+static void unhook_modprobe() {
+    if (!modprobe_helper[0]) return;
+    int fd = open("/proc/sys/kernel/modprobe", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    write(fd, modprobe_helper, strlen(modprobe_helper));
+    close(fd);
+}
+
+static void record_modules() {
+    FILE *f = fopen("/proc/modules", "re");
+    if (!f) return;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *space = strchr(line, ' ');
+        if (space) *space = '\0';
+        record_usage("module", line);
+    }
+    fclose(f);
+}
+
 static int run_command(const char *cmd, char *const argv[]) {
+    static char last[256];
+    if (strcmp(last, cmd) != 0) {
+        strncpy(last, cmd, sizeof(last) - 1);
+        record_usage("exec", cmd);
+    }
     pid_t pid = fork();
     if (pid == 0) {
         execv(cmd, argv);
@@ -100,9 +179,16 @@ static void parse_cmdline() {
         }
 
         if (strcmp(key, "root") == 0 && val) {
+            char *image = strstr(val, ":/");
+            if (image) {
+                strncpy(root_image, image + 1, sizeof(root_image) - 1);
+                *image = '\0';
+            }
             strncpy(root_dev, val, sizeof(root_dev) - 1);
+            root_given = true;
         } else if (strcmp(key, "rootfstype") == 0 && val) {
             strncpy(root_type, val, sizeof(root_type) - 1);
+            root_type_given = true;
         } else if (strcmp(key, "rootflags") == 0 && val) {
             strncpy(root_flags, val, sizeof(root_flags) - 1);
         } else if (strcmp(key, "init") == 0 && val) {
@@ -113,8 +199,22 @@ static void parse_cmdline() {
             strcpy(root_flags, "rw");
         } else if (strcmp(key, "ro") == 0) {
             strcpy(root_flags, "ro");
+        } else if (strcmp(key, "resume") == 0 && val) {
+            strncpy(resume_dev, val, sizeof(resume_dev) - 1);
+        } else if (strcmp(key, "resume_offset") == 0 && val) {
+            strncpy(resume_offset, val, sizeof(resume_offset) - 1);
+        } else if (strcmp(key, "noresume") == 0) {
+            noresume = true;
+        } else if (strcmp(key, "rd.payload") == 0 && val) {
+            payload_mode = atoi(val);
         } else if (strcmp(key, "rd.debug") == 0 || strcmp(key, "initrd.debug") == 0) {
             verbose = true;
+        } else if (strcmp(key, "rd.toram") == 0) {
+            to_ram = !val || atoi(val) != 0;
+        } else if (strcmp(key, "rd.overlay") == 0) {
+            root_overlay = !val || atoi(val) != 0;
+        } else if (strcmp(key, "rd.readahead") == 0 && val) {
+            readahead_enabled = atoi(val) != 0;
         } else if (strcmp(key, "rd.modules") == 0 && val) {
             strncpy(modules_to_load, val, sizeof(modules_to_load) - 1);
         }
@@ -198,53 +298,875 @@ static void load_modules() {
     MSG(" modules\n");
 }
 
-static char *resolve_device(char *dev) {
+static bool device_link(const char *dev, char *link, size_t len) {
+    const char *type, *val;
+    if (strncmp(dev, "UUID=", 5) == 0) {
+        type = "by-uuid";
+        val = dev + 5;
+    } else if (strncmp(dev, "PARTUUID=", 9) == 0) {
+        type = "by-partuuid";
+        val = dev + 9;
+    } else if (strncmp(dev, "LABEL=", 6) == 0) {
+        type = "by-label";
+        val = dev + 6;
+    } else {
+        snprintf(link, len, "%s", dev);
+        return false;
+    }
+    snprintf(link, len, "/dev/disk/%s/%s", type, val);
+    return true;
+}
+
+static void copy_id(char *out, size_t len, const unsigned char *src, size_t n) {
+    size_t i = 0;
+    for (; i < n && i + 1 < len && src[i]; i++) out[i] = src[i];
+    while (i > 0 && out[i - 1] == ' ') i--;
+    out[i] = '\0';
+}
+
+static void format_uuid(char *out, size_t len, const unsigned char *u) {
+    snprintf(out, len, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7],
+             u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+}
+
+// UUID= and LABEL= straight from the superblock, since there is no udev to
+// populate /dev/disk; covers the filesystems and containers init mounts or opens
+static bool superblock_ids(int fd, char *uuid, size_t uuid_len, char *label, size_t label_len) {
+    static unsigned char buf[4096];
+    uuid[0] = label[0] = '\0';
+    if (pread(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) return false;
+
+    if (memcmp(buf, "LUKS\xba\xbe", 6) == 0) {
+        copy_id(uuid, uuid_len, buf + 168, 40);
+        if (buf[7] == 2) copy_id(label, label_len, buf + 24, 48);
+        return true;
+    }
+    if (memcmp(buf, "XFSB", 4) == 0) {
+        format_uuid(uuid, uuid_len, buf + 32);
+        copy_id(label, label_len, buf + 108, 12);
+        return true;
+    }
+    if (memcmp(buf + 4086, "SWAPSPACE2", 10) == 0) {
+        format_uuid(uuid, uuid_len, buf + 1036);
+        copy_id(label, label_len, buf + 1052, 16);
+        return true;
+    }
+    if (buf[1024 + 0x38] == 0x53 && buf[1024 + 0x39] == 0xef) {
+        format_uuid(uuid, uuid_len, buf + 1024 + 0x68);
+        copy_id(label, label_len, buf + 1024 + 0x78, 16);
+        return true;
+    }
+    if (buf[510] == 0x55 && buf[511] == 0xaa) {
+        const unsigned char *serial = nullptr, *name = nullptr;
+        if (memcmp(buf + 0x52, "FAT32", 5) == 0) {
+            serial = buf + 0x43;
+            name = buf + 0x47;
+        } else if (memcmp(buf + 0x36, "FAT", 3) == 0) {
+            serial = buf + 0x27;
+            name = buf + 0x2b;
+        }
+        if (serial) {
+            snprintf(uuid, uuid_len, "%02X%02X-%02X%02X", serial[3], serial[2], serial[1], serial[0]);
+            copy_id(label, label_len, name, 11);
+            if (strcmp(label, "NO NAME") == 0) label[0] = '\0';
+            return true;
+        }
+    }
+    if (pread(fd, buf, sizeof(buf), 65536) == (ssize_t)sizeof(buf) && memcmp(buf + 0x40, "_BHRfS_M", 8) == 0) {
+        format_uuid(uuid, uuid_len, buf + 0x20);
+        copy_id(label, label_len, buf + 0x12b, 256);
+        return true;
+    }
+    return false;
+}
+
+static bool read_sys(const char *path, char *buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return true;
+}
+
+static void block_node(const char *name, char *node, size_t len) {
+    snprintf(node, len, "/dev/%s", name);
+    for (char *p = node + 5; *p; p++) {
+        if (*p == '!') *p = '/';
+    }
+}
+
+// PARTUUID= from the partition table of the parent disk: the GPT unique
+// partition GUID, or SSSSSSSS-NN built from the MBR disk signature
+static bool partition_uuid(const char *name, char *out, size_t len) {
+    char path[512], value[32], real[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/block/%s/partition", name);
+    if (!read_sys(path, value, sizeof(value))) return false;
+    int number = atoi(value);
+    snprintf(path, sizeof(path), "/sys/class/block/%s", name);
+    if (number <= 0 || !realpath(path, real)) return false;
+    char *slash = strrchr(real, '/');
+    if (!slash) return false;
+    *slash = '\0';
+    const char *disk = strrchr(real, '/') + 1;
+
+    unsigned sector = 512;
+    snprintf(path, sizeof(path), "/sys/class/block/%s/queue/logical_block_size", disk);
+    if (read_sys(path, value, sizeof(value)) && atoi(value) >= 512) sector = atoi(value);
+
+    char node[300];
+    block_node(disk, node, sizeof(node));
+    int fd = open(node, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) return false;
+    unsigned char mbr[512], header[512], entry[128];
+    bool ok = false;
+    if (pread(fd, mbr, sizeof(mbr), 0) == (ssize_t)sizeof(mbr) && mbr[510] == 0x55 && mbr[511] == 0xaa) {
+        if (mbr[446 + 4] == 0xee) {
+            if (pread(fd, header, sizeof(header), sector) == (ssize_t)sizeof(header) &&
+                memcmp(header, "EFI PART", 8) == 0) {
+                uint64_t table;
+                uint32_t size;
+                memcpy(&table, header + 72, sizeof(table));
+                memcpy(&size, header + 84, sizeof(size));
+                off_t offset = (off_t)(table * sector + (uint64_t)(number - 1) * size);
+                if (size >= sizeof(entry) && pread(fd, entry, sizeof(entry), offset) == (ssize_t)sizeof(entry)) {
+                    const unsigned char *g = entry + 16;
+                    snprintf(out, len, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                             g[3], g[2], g[1], g[0], g[5], g[4], g[7], g[6],
+                             g[8], g[9], g[10], g[11], g[12], g[13], g[14], g[15]);
+                    ok = true;
+                }
+            }
+        } else {
+            uint32_t signature;
+            memcpy(&signature, mbr + 440, sizeof(signature));
+            snprintf(out, len, "%08x-%02x", signature, number);
+            ok = true;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static bool scan_block_devices(const char *dev, char *node, size_t len) {
+    DIR *dir = opendir("/sys/class/block");
+    if (!dir) return false;
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        char candidate[300], uuid[64], label[256];
+        block_node(entry->d_name, candidate, sizeof(candidate));
+        if (strncmp(dev, "PARTUUID=", 9) == 0) {
+            found = partition_uuid(entry->d_name, uuid, sizeof(uuid)) && strcasecmp(uuid, dev + 9) == 0;
+        } else {
+            int fd = open(candidate, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+            if (fd < 0) continue;
+            if (superblock_ids(fd, uuid, sizeof(uuid), label, sizeof(label))) {
+                found = strncmp(dev, "UUID=", 5) == 0 ? strcasecmp(uuid, dev + 5) == 0 : strcmp(label, dev + 6) == 0;
+            }
+            close(fd);
+        }
+        if (found && strlen(candidate) >= len) found = false;
+        if (found) memcpy(node, candidate, strlen(candidate) + 1);
+    }
+    closedir(dir);
+    return found;
+}
+
+// Maps a root=/resume= style spec to a device node: a /dev/disk link when
+// something created one, otherwise a scan of /sys/class/block; MAJ:MIN goes
+// through /sys/dev/block
+static bool find_device(const char *dev, char *node, size_t len) {
+    char link[512], full[PATH_MAX];
+    if (!device_link(dev, link, sizeof(link))) {
+        unsigned maj, min;
+        char extra;
+        if (sscanf(dev, "%u:%u%c", &maj, &min, &extra) == 2) {
+            snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", maj, min);
+            if (!realpath(link, full)) return false;
+            block_node(strrchr(full, '/') + 1, node, len);
+        } else {
+            snprintf(node, len, "%s", dev);
+        }
+        return access(node, F_OK) == 0;
+    }
+    if (access(link, F_OK) == 0 && realpath(link, full) && strlen(full) < len) {
+        memcpy(node, full, strlen(full) + 1);
+        return true;
+    }
+    return scan_block_devices(dev, node, len);
+}
+
+static bool device_present(const char *dev, int seconds) {
+    char node[256];
+    for (int i = 0; i < seconds * 10; i++) {
+        if (find_device(dev, node, sizeof(node))) return true;
+        usleep(100000);
+    }
+    return find_device(dev, node, sizeof(node));
+}
+
+static char *resolve_device(char *dev, int seconds) {
     static char resolved[256];
+    if (dev[0] == '/') return dev;
+
+    if (verbose) {
+        MSG("::   resolving: ");
+        print_str(dev);
+        MSG("\n");
+    }
+    for (int i = 0; i < seconds * 10; i++) {
+        if (find_device(dev, resolved, sizeof(resolved))) return resolved;
+        if (i % 10 == 0) MSG(":: waiting for device...\n");
+        usleep(100000);
+    }
+    ERR(":: failed to resolve device\n");
+    return dev;
+}
+
+static bool load_core_modules() {
+    int fd = open("/core/modules.order", O_RDONLY);
+    if (fd < 0) return false;
+    char list[4096];
+    ssize_t n = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (n < 0) n = 0;
+    list[n] = '\0';
+
+    MSG(":: loading core modules\n");
+    int loaded = 0;
+    for (char *name = strtok(list, "\n"); name; name = strtok(nullptr, "\n")) {
+        char path[512];
+        snprintf(path, sizeof(path), "/core/modules/%s", name);
+        int mfd = open(path, O_RDONLY | O_CLOEXEC);
+        if (mfd < 0) continue;
+        if (syscall(SYS_finit_module, mfd, "", 0) == 0 || errno == EEXIST) {
+            loaded++;
+            if (verbose) {
+                MSG("::   loaded: ");
+                print_str(name);
+                MSG("\n");
+            }
+        } else if (verbose) {
+            MSG("::   failed: ");
+            print_str(name);
+            MSG(" (");
+            print_str(strerror(errno));
+            MSG(")\n");
+        }
+        close(mfd);
+    }
+
+    MSG("::   loaded ");
+    print_num(loaded);
+    MSG(" core modules\n");
+    return true;
+}
+
+static bool plan_string(const unsigned char *buf, ssize_t len, ssize_t &pos, char *out, size_t size) {
+    if (pos >= len) return false;
+    size_t n = buf[pos++];
+    if (pos + (ssize_t)n > len || n >= size) return false;
+    memcpy(out, buf + pos, n);
+    out[n] = '\0';
+    pos += n;
+    return true;
+}
+
+static bool plan_layer(int kind, char *name, char *source) {
+    char dev[256];
+    if (kind == 1) {
+        char *argv[] = {(char*)"/usr/bin/mdadm", (char*)"--assemble", (char*)"--scan", nullptr};
+        return run_command(argv[0], argv) == 0;
+    } else if (kind == 2) {
+        char *argv[] = {(char*)"/usr/bin/lvm", (char*)"vgchange", (char*)"-ay", name, nullptr};
+        return run_command(argv[0], argv) == 0;
+    } else if (kind == 3) {
+        strncpy(dev, resolve_device(source, 30), sizeof(dev) - 1);
+        dev[sizeof(dev) - 1] = '\0';
+        char *argv[] = {(char*)"/usr/bin/cryptsetup", (char*)"open", dev, name, nullptr};
+        return run_command(argv[0], argv) == 0;
+    }
+    return false;
+}
+
+static bool follow_boot_plan() {
+    int fd = open("/etc/bootplan.bin", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    static unsigned char buf[65536];
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (len < 4 || memcmp(buf, "NBP1", 4) != 0) return false;
+
+    ssize_t pos = 4;
+    char kver[256], root[sizeof(root_dev)], fstype[sizeof(root_type)];
+    struct utsname uts;
+    if (!plan_string(buf, len, pos, kver, sizeof(kver)) ||
+        !plan_string(buf, len, pos, root, sizeof(root)) ||
+        !plan_string(buf, len, pos, fstype, sizeof(fstype))) {
+        return false;
+    }
+    if (uname(&uts) < 0 || strcmp(uts.release, kver) != 0) {
+        MSG(":: boot plan is for another kernel, ignoring\n");
+        return false;
+    }
+    if (root_given && strcmp(root_dev, root) != 0) {
+        MSG(":: root= overrides boot plan\n");
+        return false;
+    }
+    if (root_type_given && strcmp(root_type, fstype) != 0) {
+        MSG(":: rootfstype= overrides boot plan\n");
+        return false;
+    }
+    if (modules_to_load[0]) {
+        MSG(":: rd.modules= overrides boot plan\n");
+        return false;
+    }
+
+    MSG(":: following boot plan\n");
+    int loaded = 0;
+    int levels = pos < len ? buf[pos++] : 0;
+    for (int l = 0; l < levels; l++) {
+        if (pos >= len) return false;
+        int count = buf[pos++];
+        pid_t pids[256];
+        char name[256];
+        bool parsed = true;
+        for (int i = 0; i < count; i++) {
+            if (!plan_string(buf, len, pos, name, sizeof(name))) {
+                parsed = false;
+                count = i;
+                break;
+            }
+            char path[sizeof(kver) + sizeof(name) + 32];
+            snprintf(path, sizeof(path), "/usr/lib/modules/%s/%s", kver, name);
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                int mfd = open(path, O_RDONLY | O_CLOEXEC);
+                _exit(mfd >= 0 && (syscall(SYS_finit_module, mfd, "", 0) == 0 || errno == EEXIST) ? 0 : 1);
+            }
+            if (verbose) {
+                MSG("::   loading: ");
+                print_str(name);
+                MSG("\n");
+            }
+        }
+        bool ok = parsed;
+        for (int i = 0; i < count; i++) {
+            int status;
+            if (pids[i] < 0 || waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                ok = false;
+            } else {
+                loaded++;
+            }
+        }
+        if (!parsed) return false;
+        if (!ok) {
+            MSG(":: boot plan module load failed, falling back\n");
+            return false;
+        }
+    }
+    MSG("::   loaded ");
+    print_num(loaded);
+    MSG(" planned modules\n");
+
+    int layers = pos < len ? buf[pos++] : 0;
+    for (int i = 0; i < layers; i++) {
+        char name[256], source[256];
+        if (pos >= len) return false;
+        int kind = buf[pos++];
+        if (!plan_string(buf, len, pos, name, sizeof(name)) ||
+            !plan_string(buf, len, pos, source, sizeof(source))) {
+            return false;
+        }
+        if (!plan_layer(kind, name, source)) {
+            MSG(":: boot plan storage layer failed: ");
+            print_str(name);
+            MSG(", falling back\n");
+            return false;
+        }
+    }
+
+    if (!device_present(root, 10)) {
+        MSG(":: planned root device missing, falling back\n");
+        return false;
+    }
+    memcpy(root_dev, root, sizeof(root_dev));
+    memcpy(root_type, fstype, sizeof(root_type));
+    return true;
+}
+
+static const char *image_fstype(const char *path) {
+    unsigned char buf[1028];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n >= 4 && memcmp(buf, "hsqs", 4) == 0) return "squashfs";
+    if (n >= 1028) {
+        uint32_t magic;
+        memcpy(&magic, buf + 1024, sizeof(magic));
+        if (magic == 0xE0F5E1E2) return "erofs";
+    }
+    return nullptr;
+}
+
+static bool loop_attach(const char *image, char *loopdev, size_t len, bool direct) {
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) return false;
+    int nr = ioctl(ctl, LOOP_CTL_GET_FREE);
+    close(ctl);
+    if (nr < 0) return false;
+    snprintf(loopdev, len, "/dev/loop%d", nr);
+
+    int lfd = -1;
+    for (int i = 0; i < 50 && lfd < 0; i++) {
+        lfd = open(loopdev, O_RDWR | O_CLOEXEC);
+        if (lfd < 0) usleep(10000);
+    }
+    int ffd = open(image, O_RDONLY | O_CLOEXEC);
+    if (lfd < 0 || ffd < 0) {
+        if (lfd >= 0) close(lfd);
+        if (ffd >= 0) close(ffd);
+        return false;
+    }
+
+    struct loop_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.fd = ffd;
+    cfg.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | (direct ? LO_FLAGS_DIRECT_IO : 0);
+    strncpy((char*)cfg.info.lo_file_name, image, LO_NAME_SIZE - 1);
+    bool ok = ioctl(lfd, LOOP_CONFIGURE, &cfg) == 0;
+    if (!ok && direct) {
+        cfg.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+        ok = ioctl(lfd, LOOP_CONFIGURE, &cfg) == 0;
+    }
+    if (!ok && ioctl(lfd, LOOP_SET_FD, ffd) == 0) {
+        ok = ioctl(lfd, LOOP_SET_STATUS64, &cfg.info) == 0;
+        if (ok && direct) ioctl(lfd, LOOP_SET_DIRECT_IO, 1);
+    }
+    close(ffd);
+    close(lfd);
+    return ok;
+}
+
+static bool mount_payload() {
+    if (payload_mounted) return true;
+    const char *image = "/core/payload.img";
+    if (access(image, F_OK) < 0) return false;
+
+    const char *fstype = image_fstype(image);
+    char loopdev[32];
+    if (!fstype || !loop_attach(image, loopdev, sizeof(loopdev), false)) {
+        ERR(":: cannot attach payload image\n");
+        return false;
+    }
+    if (mount(loopdev, "/core/payload", fstype, MS_RDONLY, nullptr) < 0) {
+        ERR(":: payload mount failed: ");
+        print_str(strerror(errno));
+        ERR("\n");
+        return false;
+    }
+    mount("/core/payload/usr", "/usr", nullptr, MS_BIND, nullptr);
+    mount("/core/payload/etc", "/etc", nullptr, MS_BIND, nullptr);
+    payload_mounted = true;
+
+    MSG(":: mounted ");
+    print_str(fstype);
+    MSG(" payload\n");
+    return true;
+}
+
+static void modprobe(const char *module) {
+    char *argv[] = {(char*)"/usr/bin/modprobe", (char*)"-qab", (char*)module, nullptr};
+    run_command(argv[0], argv);
+}
+
+static bool mount_carrier(const char *dev, const char *target) {
+    if (mount(dev, target, root_type, MS_RDONLY, nullptr) == 0) return true;
+    if (root_type_given) return false;
+    int saved = errno;
+    FILE *f = fopen("/proc/filesystems", "re");
+    if (!f) return false;
+    char line[128];
+    bool ok = false;
+    while (!ok && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "nodev", 5) == 0) continue;
+        char *type = line + strspn(line, " \t");
+        type[strcspn(type, "\n")] = '\0';
+        ok = *type && mount(dev, target, type, MS_RDONLY, nullptr) == 0;
+    }
+    fclose(f);
+    if (!ok) errno = saved;
+    return ok;
+}
+
+static bool copy_to_ram(const char *image, const char *dir, char *copy, size_t len) {
+    int in = open(image, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) < 0) {
+        if (in >= 0) close(in);
+        return false;
+    }
+    char opts[64];
+    snprintf(opts, sizeof(opts), "size=%lluk,mode=0700", (unsigned long long)st.st_size / 1024 + 1024);
+    mkdir(dir, 0700);
+    if (mount("tmpfs", dir, "tmpfs", MS_NOSUID | MS_NODEV, opts) < 0) {
+        close(in);
+        return false;
+    }
+    snprintf(copy, len, "%s/root.img", dir);
+    int out = open(copy, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    MSG(":: copying root image to RAM\n");
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    static char buf[4 << 20];
+    ssize_t n;
+    off_t total = 0;
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            n = -1;
+            break;
+        }
+        total += n;
+    }
+    close(in);
+    close(out);
+    return n == 0 && total == st.st_size;
+}
+
+static bool mount_image_root(const char *carrier) {
+    char image[512];
+    snprintf(image, sizeof(image), "%s%s", carrier, root_image);
+    const char *fstype = image_fstype(image);
+    if (!fstype) {
+        ERR(":: not a squashfs or erofs image: ");
+        print_str(root_image);
+        ERR("\n");
+        return false;
+    }
+
+    bool direct = true;
+    if (to_ram) {
+        char copy[512];
+        if (!copy_to_ram(image, "/run/nullinitrd/ram", copy, sizeof(copy))) {
+            ERR(":: copy to RAM failed\n");
+            return false;
+        }
+        umount(carrier);
+        strcpy(image, copy);
+        direct = false;
+    }
+
+    modprobe("loop");
+    modprobe(fstype);
+    char loopdev[32];
+    if (!loop_attach(image, loopdev, sizeof(loopdev), direct)) {
+        ERR(":: cannot attach root image\n");
+        return false;
+    }
+    const char *lower = root_overlay ? "/run/nullinitrd/lower" : "/mnt/root";
+    mkdir(lower, 0755);
+    if (mount(loopdev, lower, fstype, MS_RDONLY, nullptr) < 0) {
+        ERR(":: root image mount failed: ");
+        print_str(strerror(errno));
+        ERR("\n");
+        return false;
+    }
+    MSG(":: mounted ");
+    print_str(fstype);
+    MSG(" root image\n");
+    if (!root_overlay) return true;
+
+    modprobe("overlay");
+    mkdir("/run/nullinitrd/overlay", 0755);
+    if (mount("tmpfs", "/run/nullinitrd/overlay", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755") < 0) return false;
+    mkdir("/run/nullinitrd/overlay/upper", 0755);
+    mkdir("/run/nullinitrd/overlay/work", 0755);
+    if (mount("overlay", "/mnt/root", "overlay", 0, "lowerdir=/run/nullinitrd/lower,"
+              "upperdir=/run/nullinitrd/overlay/upper,workdir=/run/nullinitrd/overlay/work") < 0) {
+        ERR(":: overlay mount failed: ");
+        print_str(strerror(errno));
+        ERR("\n");
+        return false;
+    }
+    return true;
+}
+
+static void release_payload() {
+    if (!payload_mounted) return;
+    umount2("/etc", MNT_DETACH);
+    umount2("/usr", MNT_DETACH);
+    umount2("/core/payload", MNT_DETACH);
+    payload_mounted = false;
+}
+
+static bool write_file(const char *path, const char *data) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return false;
+    ssize_t len = strlen(data);
+    bool ok = write(fd, data, len) == len;
+    close(fd);
+    return ok;
+}
+
+static int open_console() {
+    int tty = open("/dev/tty0", O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (tty < 0) tty = open("/dev/console", O_RDWR | O_NOCTTY | O_CLOEXEC);
+    return tty;
+}
+
+static void apply_font() {
+    int fd = open("/etc/font.bin", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    static unsigned char buf[1 << 18];
+    ssize_t len = 0, n;
+    while (len < (ssize_t)sizeof(buf) && (n = read(fd, buf + len, sizeof(buf) - len)) > 0) len += n;
+    close(fd);
+    if (len < 12 || memcmp(buf, "NKF1", 4) != 0) return;
+
+    struct console_font_op font;
+    font.op = KD_FONT_OP_SET;
+    font.flags = 0;
+    font.width = buf[4] | buf[5] << 8;
+    font.height = buf[6] | buf[7] << 8;
+    font.charcount = buf[8] | buf[9] << 8;
+    font.data = buf + 10;
+    size_t pos = 10 + (size_t)font.charcount * 32 * ((font.width + 7) / 8);
+    if (pos + 2 > (size_t)len) return;
+
+    int tty = open_console();
+    if (tty < 0) return;
+    if (ioctl(tty, KDFONTOP, &font) < 0) {
+        close(tty);
+        ERR(":: [!] failed to set console font\n");
+        return;
+    }
+    // replace the unicode map of the old font, or text would pick the wrong glyphs
+    static struct unipair pairs[16384];
+    size_t count = buf[pos] | buf[pos + 1] << 8;
+    pos += 2;
+    struct unimapdesc map = {0, pairs};
+    for (size_t i = 0; i < count && map.entry_ct < 16384 && pos + 4 <= (size_t)len; i++, pos += 4) {
+        pairs[map.entry_ct].unicode = buf[pos] | buf[pos + 1] << 8;
+        pairs[map.entry_ct].fontpos = buf[pos + 2] | buf[pos + 3] << 8;
+        map.entry_ct++;
+    }
+    if (map.entry_ct > 0) {
+        struct unimapinit init = {0, 0, 0};
+        ioctl(tty, PIO_UNIMAPCLR, &init);
+        ioctl(tty, PIO_UNIMAP, &map);
+    }
+    close(tty);
+    if (verbose) {
+        MSG(":: console font: ");
+        print_num(font.charcount);
+        MSG(" glyphs\n");
+    }
+}
+
+static void apply_keymap() {
+    int fd = open("/etc/keymap.bin", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    static unsigned char buf[65536];
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (len < 8 || memcmp(buf, "NKM1", 4) != 0) return;
+
+    int tty = open_console();
+    if (tty < 0) return;
 
-    if (strncmp(dev, "UUID=", 5) == 0 || strncmp(dev, "PARTUUID=", 9) == 0 ||
-        strncmp(dev, "LABEL=", 6) == 0) {
-        char link[512];
-        char *type, *val;
-
-        if (strncmp(dev, "UUID=", 5) == 0) {
-            type = (char*)"by-uuid";
-            val = dev + 5;
-        } else if (strncmp(dev, "PARTUUID=", 9) == 0) {
-            type = (char*)"by-partuuid";
-            val = dev + 9;
+    // keysyms above 0x7f are stored as unicode, which a VT only delivers in
+    // K_UNICODE mode; switch the console to UTF-8 the way unicode_start does
+    int mode;
+    if (ioctl(tty, KDGKBMODE, &mode) == 0 && mode == K_XLATE) {
+        if (ioctl(tty, KDSKBMODE, K_UNICODE) == 0) {
+            write(tty, "\033%G", 3);
         } else {
-            type = (char*)"by-label";
-            val = dev + 6;
+            ERR(":: [!] cannot switch the keyboard to unicode mode\n");
         }
+    }
+
+    size_t pos = 4;
+    size_t count = buf[pos] | buf[pos + 1] << 8;
+    pos += 2;
+    int applied = 0;
+    for (size_t i = 0; i < count && pos + 4 <= (size_t)len; i++, pos += 4) {
+        struct kbentry entry;
+        entry.kb_table = buf[pos];
+        entry.kb_index = buf[pos + 1];
+        entry.kb_value = buf[pos + 2] | buf[pos + 3] << 8;
+        if (ioctl(tty, KDSKBENT, &entry) == 0) applied++;
+    }
+    count = pos + 2 <= (size_t)len ? (buf[pos] | buf[pos + 1] << 8) : 0;
+    pos += 2;
+    for (size_t i = 0; i < count && pos + 2 <= (size_t)len; i++) {
+        struct kbsentry entry;
+        size_t n = buf[pos + 1];
+        if (pos + 2 + n > (size_t)len || n >= sizeof(entry.kb_string)) break;
+        entry.kb_func = buf[pos];
+        memcpy(entry.kb_string, buf + pos + 2, n);
+        entry.kb_string[n] = 0;
+        ioctl(tty, KDSKBSENT, &entry);
+        pos += 2 + n;
+    }
+    close(tty);
+    if (verbose) {
+        MSG(":: keymap: ");
+        print_num(applied);
+        MSG(" entries\n");
+    }
+}
 
-        snprintf(link, sizeof(link), "/dev/disk/%s/%s", type, val);
+static void try_resume() {
+    if (!resume_dev[0] || noresume) return;
 
+    if (access("/sys/power/resume", W_OK) < 0) {
         if (verbose) {
-            MSG("::   resolving: ");
-            print_str(link);
-            MSG("\n");
+            MSG("::   hibernation not supported by kernel\n");
         }
+        return;
+    }
 
-        for (int i = 0; i < 30; i++) {
-            if (access(link, F_OK) == 0) {
-                ssize_t len = readlink(link, resolved, sizeof(resolved) - 1);
-                if (len > 0) {
-                    resolved[len] = '\0';
-                    if (resolved[0] != '/') {
-                        char tmp[256];
-                        snprintf(tmp, sizeof(tmp), "/dev/%s", resolved);
-                        strcpy(resolved, tmp);
-                    }
-                    return resolved;
-                }
-            }
-            MSG(":: waiting for root device...\n");
-            sleep(1);
+    // resume=MAJ:MIN is the kernel's own syntax and goes through unchanged
+    char devnum[32];
+    unsigned maj, min;
+    char extra;
+    if (sscanf(resume_dev, "%u:%u%c", &maj, &min, &extra) == 2) {
+        snprintf(devnum, sizeof(devnum), "%u:%u", maj, min);
+    } else {
+        char dev[256];
+        bool found = false;
+        for (int i = 0; i < 50 && !(found = find_device(resume_dev, dev, sizeof(dev))); i++) {
+            if (i % 10 == 0) MSG(":: waiting for resume device...\n");
+            usleep(100000);
+        }
+        struct stat st;
+        if (!found || stat(dev, &st) < 0 || !S_ISBLK(st.st_mode)) {
+            ERR(":: resume device not found: ");
+            print_err(resume_dev);
+            ERR("\n");
+            return;
         }
-        ERR(":: failed to resolve device\n");
+        snprintf(devnum, sizeof(devnum), "%u:%u", major(st.st_rdev), minor(st.st_rdev));
     }
 
-    return dev;
+    MSG(":: checking for hibernation image: ");
+    print_str(resume_dev);
+    MSG("\n");
+
+    if (resume_offset[0] && !write_file("/sys/power/resume_offset", resume_offset)) {
+        ERR(":: failed to set resume offset\n");
+        return;
+    }
+    if (!write_file("/sys/power/resume", devnum)) {
+        ERR(":: failed to set resume device ");
+        print_err(devnum);
+        ERR(": ");
+        print_err(strerror(errno));
+        ERR("\n");
+        return;
+    }
+
+    if (verbose) {
+        MSG("::   no hibernation image, continuing normal boot\n");
+    }
+}
+
+struct ReadaheadEntry {
+    unsigned long long offset;
+    const char *path;
+};
+
+static unsigned long long physical_offset(int fd) {
+    alignas(struct fiemap) char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    struct fiemap *map = (struct fiemap*)buf;
+    memset(buf, 0, sizeof(buf));
+    map->fm_length = ~0ULL;
+    map->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0) {
+        return map->fm_extents[0].fe_physical;
+    }
+    int block = 0, size = 0;
+    if (ioctl(fd, FIBMAP, &block) == 0 && block > 0 && ioctl(fd, FIGETBSZ, &size) == 0) {
+        return (unsigned long long)block * size;
+    }
+    return ~0ULL;
+}
+
+static int compare_offset(const void *a, const void *b) {
+    unsigned long long x = ((const ReadaheadEntry*)a)->offset;
+    unsigned long long y = ((const ReadaheadEntry*)b)->offset;
+    return x < y ? -1 : x > y;
+}
+
+// execve() would kill a thread, so the helper is a process. It detaches with
+// a double fork and setsid() and holds none of init's descriptors; the real
+// init only ever sees it as an orphan adopted by pid 1.
+static void start_readahead() {
+    if (!readahead_enabled) return;
+    if (access("/var/lib/nullinitrd/readahead.list", R_OK) < 0) return;
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) {
+            waitpid(pid, nullptr, 0);
+            if (verbose) MSG(":: readahead started\n");
+        }
+        return;
+    }
+    setsid();
+    if (fork() != 0) _exit(0);
+
+    if (syscall(SYS_close_range, 0U, ~0U, 0U) < 0) {
+        for (int i = 0; i < 1024; i++) close(i);
+    }
+    int null = open("/dev/null", O_RDWR);
+    if (null == 0) {
+        dup2(null, 1);
+        dup2(null, 2);
+    }
+    chdir("/");
+    int fd = open("/var/lib/nullinitrd/readahead.list", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) _exit(0);
+
+    static char list[1 << 20];
+    static ReadaheadEntry entries[16384];
+    ssize_t len = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (len <= 0) _exit(0);
+    list[len] = '\0';
+
+    int count = 0;
+    for (char *line = strtok(list, "\n"); line && count < 16384; line = strtok(nullptr, "\n")) {
+        if (line[0] != '/') continue;
+        int ffd = open(line, O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (ffd < 0) ffd = open(line, O_RDONLY | O_CLOEXEC);
+        if (ffd < 0) continue;
+        entries[count].offset = physical_offset(ffd);
+        entries[count].path = line;
+        count++;
+        close(ffd);
+    }
+    qsort(entries, count, sizeof(entries[0]), compare_offset);
+
+    for (int i = 0; i < count; i++) {
+        int ffd = open(entries[i].path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (ffd < 0) ffd = open(entries[i].path, O_RDONLY | O_CLOEXEC);
+        if (ffd < 0) continue;
+        struct stat st;
+        if (fstat(ffd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (readahead(ffd, 0, st.st_size) < 0) posix_fadvise(ffd, 0, st.st_size, POSIX_FADV_WILLNEED);
+        }
+        close(ffd);
+    }
+    _exit(0);
 }
 
 static void switch_root() {
@@ -254,17 +1176,38 @@ static void switch_root() {
     chdir("/");
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (getpid() != 1 && argc > 1) {
+        record_usage("request", argv[argc - 1]);
+        argv[0] = (char*)"/usr/bin/modprobe";
+        execv(argv[0], argv);
+        return 1;
+    }
+
     MSG(":: nullinitrd\n");
 
     do_mount("proc", "/proc", "proc", MS_NOSUID | MS_NOEXEC | MS_NODEV, nullptr);
     do_mount("sysfs", "/sys", "sysfs", MS_NOSUID | MS_NOEXEC | MS_NODEV, nullptr);
     do_mount("devtmpfs", "/dev", "devtmpfs", MS_NOSUID, "mode=0755");
     do_mount("tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755");
+    mkdir("/run/nullinitrd", 0755);
+    hook_modprobe();
     mkdir("/dev/pts", 0755);
 
     parse_cmdline();
-    load_modules();
+    apply_font();
+    apply_keymap();
+    if (follow_boot_plan()) {
+        MSG(":: root device ready\n");
+    } else if (!load_core_modules()) {
+        load_modules();
+    } else if (payload_mode == 1 ||
+               (payload_mode != 0 && (modules_to_load[0] || !device_present(root_dev, 2)))) {
+        if (mount_payload()) load_modules();
+    } else {
+        MSG(":: root device ready, payload not needed\n");
+    }
+    try_resume();
 
     if (root_delay > 0) {
         MSG(":: waiting ");
@@ -273,7 +1216,7 @@ int main() {
         sleep(root_delay);
     }
 
-    char *dev = resolve_device(root_dev);
+    char *dev = resolve_device(root_dev, 30);
     MSG(":: mounting root: ");
     print_str(dev);
     MSG(" (");
@@ -283,9 +1226,13 @@ int main() {
     mkdir("/mnt/root", 0755);
     unsigned long mflags = 0;
     if (strstr(root_flags, "ro")) mflags |= MS_RDONLY;
+    const char *carrier = "/run/nullinitrd/carrier";
+    if (root_image[0]) mkdir(carrier, 0755);
 
     for (int i = 0; i < 30; i++) {
-        if (mount(dev, "/mnt/root", root_type, mflags, nullptr) == 0) break;
+        if (root_image[0] ? mount_carrier(dev, carrier) : mount(dev, "/mnt/root", root_type, mflags, nullptr) == 0) {
+            break;
+        }
         if (i == 29) {
             ERR(":: mount error: ");
             print_str(strerror(errno));
@@ -300,27 +1247,34 @@ int main() {
         MSG(":: retrying root mount...\n");
         sleep(1);
     }
+    if (root_image[0] && !mount_image_root(carrier)) {
+        panic("failed to mount root image");
+    }
 
     MSG(":: switching root\n");
+    release_payload();
+    record_modules();
+    unhook_modprobe();
     umount("/proc");
     umount("/sys");
     umount("/dev");
-    umount("/run");
+    if (mount("/run", "/mnt/root/run", nullptr, MS_MOVE, nullptr) < 0) umount("/run");
 
     switch_root();
+    start_readahead();
 
     MSG(":: exec ");
     print_str(init_path);
     MSG("\n");
 
-    char *argv[] = {init_path, nullptr};
+    char *init_argv[] = {init_path, nullptr};
     char *envp[] = {
         (char*)"HOME=/",
         (char*)"TERM=linux",
         (char*)"PATH=/sbin:/bin:/usr/sbin:/usr/bin",
         nullptr
     };
-    execve(init_path, argv, envp);
+    execve(init_path, init_argv, envp);
 
     ERR(":: execve failed: ");
     print_str(strerror(errno));
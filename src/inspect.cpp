@@ -0,0 +1,296 @@
+#include "inspect.hpp"
+#include "image.hpp"
+#include "elf.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace inspect {
+
+namespace {
+
+std::string mode_string(mode_t mode) {
+    char type = '-';
+    if (S_ISDIR(mode)) type = 'd';
+    else if (S_ISLNK(mode)) type = 'l';
+    else if (S_ISCHR(mode)) type = 'c';
+    else if (S_ISBLK(mode)) type = 'b';
+    else if (S_ISFIFO(mode)) type = 'p';
+    else if (S_ISSOCK(mode)) type = 's';
+
+    std::string s(1, type);
+    const char* rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) {
+        s += (mode & (0400 >> i)) ? rwx[i] : '-';
+    }
+    return s;
+}
+
+bool safe_name(const std::string& name) {
+    if (name.empty() || name.front() == '/') return false;
+    for (const auto& part : fs::path(name)) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+std::string module_name(const std::string& path) {
+    std::string name = fs::path(path).filename().string();
+    size_t ko = name.find(".ko");
+    if (ko == std::string::npos) return "";
+    name = name.substr(0, ko);
+    std::replace(name.begin(), name.end(), '-', '_');
+    return name;
+}
+
+struct Node {
+    mode_t mode;
+    std::string target;
+};
+
+class Tree {
+public:
+    void add(const ImageReader::Entry& entry) {
+        nodes[entry.name] = {entry.mode, entry.target};
+    }
+
+    const Node* find(const std::string& path) const {
+        std::string resolved = resolve(path);
+        auto it = nodes.find(resolved);
+        return it == nodes.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::map<std::string, Node> nodes;
+
+    std::string resolve(const std::string& path) const {
+        std::vector<std::string> todo;
+        for (const auto& part : fs::path(path).relative_path()) {
+            todo.push_back(part.string());
+        }
+        std::reverse(todo.begin(), todo.end());
+
+        std::vector<std::string> done;
+        int links = 0;
+        while (!todo.empty()) {
+            std::string part = todo.back();
+            todo.pop_back();
+            if (part.empty() || part == ".") continue;
+            if (part == "..") {
+                if (!done.empty()) done.pop_back();
+                continue;
+            }
+            done.push_back(part);
+
+            std::string current;
+            for (const auto& p : done) current += (current.empty() ? "" : "/") + p;
+            auto it = nodes.find(current);
+            if (it == nodes.end() || !S_ISLNK(it->second.mode) || ++links > 40) continue;
+
+            done.pop_back();
+            fs::path target(it->second.target);
+            if (target.is_absolute()) done.clear();
+            std::vector<std::string> parts;
+            for (const auto& p : target.relative_path()) parts.push_back(p.string());
+            for (auto p = parts.rbegin(); p != parts.rend(); ++p) todo.push_back(*p);
+        }
+
+        std::string result;
+        for (const auto& p : done) result += (result.empty() ? "" : "/") + p;
+        return result;
+    }
+};
+
+}
+
+int list(const std::string& image) {
+    ImageReader reader(image);
+    size_t entries = 0;
+    uint64_t bytes = 0;
+    size_t segment = static_cast<size_t>(-1);
+    reader.scan([&](const ImageReader::Entry& entry, const ImageReader::Reader&) {
+        if (entry.segment != segment) {
+            segment = entry.segment;
+            const auto& seg = reader.segments()[segment];
+            std::cout << ":: segment " << segment << ": " << seg.compression << " at offset " << seg.offset << std::endl;
+        }
+        char size[24];
+        snprintf(size, sizeof(size), "%10llu", static_cast<unsigned long long>(entry.size));
+        std::cout << mode_string(entry.mode) << " " << size << " " << entry.name;
+        if (S_ISLNK(entry.mode)) std::cout << " -> " << entry.target;
+        std::cout << "\n";
+        entries++;
+        bytes += entry.size;
+    });
+    std::cout << ":: " << entries << " entries, " << bytes << " bytes in "
+              << reader.segments().size() << " segment(s)" << std::endl;
+    return 0;
+}
+
+int extract(const std::string& image, const std::string& dir) {
+    ImageReader reader(image);
+    fs::create_directories(dir);
+    fs::path base = fs::canonical(dir);
+    std::vector<std::pair<fs::path, mode_t>> directories;
+    size_t skipped = 0;
+    reader.scan([&](const ImageReader::Entry& entry, const ImageReader::Reader& read) {
+        fs::path dst = base / entry.name;
+        fs::path parent = fs::weakly_canonical(dst.parent_path()).lexically_relative(base);
+        if (!safe_name(entry.name) || parent.empty() || *parent.begin() == "..") {
+            std::cerr << ":: [!] skipping unsafe path: " << entry.name << std::endl;
+            skipped++;
+            return;
+        }
+        fs::create_directories(dst.parent_path());
+        std::error_code ec;
+        if (S_ISDIR(entry.mode)) {
+            fs::create_directories(dst, ec);
+            directories.emplace_back(dst, entry.mode & 07777);
+        } else if (S_ISLNK(entry.mode)) {
+            fs::remove(dst, ec);
+            fs::create_symlink(entry.target, dst, ec);
+        } else if (S_ISREG(entry.mode)) {
+            fs::remove(dst, ec);
+            std::ofstream out(dst, std::ios::binary);
+            char buffer[1 << 16];
+            size_t n;
+            while ((n = read(buffer, sizeof(buffer))) > 0) {
+                out.write(buffer, n);
+            }
+            out.close();
+            chmod(dst.c_str(), entry.mode & 07777);
+        } else {
+            skipped++;
+        }
+    });
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+        chmod(it->first.c_str(), it->second);
+    }
+    std::cout << ":: extracted " << image << " -> " << dir;
+    if (skipped) std::cout << " (" << skipped << " entries skipped)";
+    std::cout << std::endl;
+    return 0;
+}
+
+int verify(const std::string& image) {
+    ImageReader reader(image);
+    Tree tree;
+    std::map<std::string, std::string> modules;
+    std::map<std::string, std::vector<std::string>> module_deps;
+    std::map<std::string, elf::Info> binaries;
+    bool has_modules_dep = false;
+    bool has_payload = false;
+
+    reader.scan([&](const ImageReader::Entry& entry, const ImageReader::Reader& read) {
+        tree.add(entry);
+        if (!S_ISREG(entry.mode)) return;
+
+        std::string name = fs::path(entry.name).filename().string();
+        if (name == "modules.dep") has_modules_dep = true;
+        if (entry.name == "core/payload.img") has_payload = true;
+
+        std::string module = module_name(entry.name);
+        if (!module.empty()) modules[module] = entry.name;
+
+        char magic[4];
+        if (entry.size < sizeof(magic) || read(magic, sizeof(magic)) != sizeof(magic)) return;
+        if (memcmp(magic, "\x7f" "ELF", 4) != 0) return;
+
+        std::string data(magic, sizeof(magic));
+        data.resize(entry.size);
+        read(&data[sizeof(magic)], entry.size - sizeof(magic));
+        std::istringstream stream(data);
+
+        if (!module.empty()) {
+            std::vector<std::string> deps;
+            for (const auto& depends : elf::modinfo(stream, "depends")) {
+                std::stringstream ss(depends);
+                std::string dep;
+                while (std::getline(ss, dep, ',')) {
+                    std::replace(dep.begin(), dep.end(), '-', '_');
+                    if (!dep.empty()) deps.push_back(dep);
+                }
+            }
+            module_deps[module] = deps;
+            return;
+        }
+        elf::Info info = elf::read(stream);
+        if (info.valid && (!info.interpreter.empty() || !info.needed.empty())) {
+            binaries[entry.name] = info;
+        }
+    });
+
+    int problems = 0;
+    auto problem = [&problems](const std::string& msg) {
+        std::cerr << ":: [!] " << msg << std::endl;
+        problems++;
+    };
+
+    if (!modules.empty() && !has_modules_dep) {
+        problem("modules.dep is missing");
+    }
+    for (const auto& [module, deps] : module_deps) {
+        for (const auto& dep : deps) {
+            if (modules.count(dep) == 0) {
+                problem("module " + module + " needs missing module " + dep);
+            }
+        }
+    }
+
+    const std::vector<std::string> default_dirs = {
+        "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu"
+    };
+    for (const auto& [binary, info] : binaries) {
+        if (!info.interpreter.empty()) {
+            const Node* interp = tree.find(info.interpreter);
+            if (!interp || !S_ISREG(interp->mode)) {
+                problem(binary + " needs missing interpreter " + info.interpreter);
+            }
+        }
+        std::vector<std::string> dirs;
+        for (auto dir : info.runpath) {
+            size_t origin = dir.find("$ORIGIN");
+            if (origin != std::string::npos) {
+                dir.replace(origin, 7, "/" + fs::path(binary).parent_path().string());
+            }
+            dirs.push_back(dir);
+        }
+        dirs.insert(dirs.end(), default_dirs.begin(), default_dirs.end());
+
+        for (const auto& lib : info.needed) {
+            bool found = false;
+            for (const auto& dir : dirs) {
+                const Node* node = tree.find(dir + "/" + lib);
+                if (node && S_ISREG(node->mode)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                problem(binary + " needs missing library " + lib);
+            }
+        }
+    }
+
+    std::cout << ":: checked " << module_deps.size() << " module(s) and " << binaries.size() << " binary(ies)";
+    if (has_payload) std::cout << " (payload image contents not inspected)";
+    std::cout << std::endl;
+    if (problems > 0) {
+        std::cerr << ":: [!] " << problems << " problem(s) found" << std::endl;
+        return 1;
+    }
+    std::cout << ":: image ok" << std::endl;
+    return 0;
+}
+
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+
+namespace inspect {
+    int list(const std::string& image);
+    int extract(const std::string& image, const std::string& dir);
+    int verify(const std::string& image);
+}
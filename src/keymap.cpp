@@ -0,0 +1,435 @@
+#include "keymap.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+
+enum { KT_LATIN, KT_FN, KT_SPEC, KT_PAD, KT_DEAD, KT_CONS, KT_CUR, KT_SHIFT, KT_META, KT_ASCII, KT_LOCK,
+       KT_LETTER, KT_SLOCK };
+
+enum { KG_SHIFT, KG_ALTGR, KG_CTRL, KG_ALT, KG_SHIFTL, KG_SHIFTR, KG_CTRLL, KG_CTRLR, KG_CAPSSHIFT };
+
+static uint16_t K(int type, int value) {
+    return static_cast<uint16_t>((type << 8) | value);
+}
+
+static const char* const latin_names[256] = {
+    "nul", "Control_a", "Control_b", "Control_c", "Control_d", "Control_e", "Control_f", "Control_g",
+    "BackSpace", "Tab", "Linefeed", "Control_k", "Control_l", "Control_m", "Control_n", "Control_o",
+    "Control_p", "Control_q", "Control_r", "Control_s", "Control_t", "Control_u", "Control_v", "Control_w",
+    "Control_x", "Control_y", "Control_z", "Escape", "Control_backslash", "Control_bracketright",
+    "Control_asciicircum", "Control_underscore",
+    "space", "exclam", "quotedbl", "numbersign", "dollar", "percent", "ampersand", "apostrophe",
+    "parenleft", "parenright", "asterisk", "plus", "comma", "minus", "period", "slash",
+    "zero", "one", "two", "three", "four", "five", "six", "seven",
+    "eight", "nine", "colon", "semicolon", "less", "equal", "greater", "question",
+    "at", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O",
+    "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z",
+    "bracketleft", "backslash", "bracketright", "asciicircum", "underscore",
+    "grave", "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o",
+    "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+    "braceleft", "bar", "braceright", "asciitilde", "Delete",
+    "", "", "", "", "", "", "", "", "", "", "", "", "", "", "", "",
+    "", "", "", "", "", "", "", "", "", "", "", "", "", "", "", "",
+    "nobreakspace", "exclamdown", "cent", "sterling", "currency", "yen", "brokenbar", "section",
+    "diaeresis", "copyright", "ordfeminine", "guillemotleft", "notsign", "hyphen", "registered", "macron",
+    "degree", "plusminus", "twosuperior", "threesuperior", "acute", "mu", "paragraph", "periodcentered",
+    "cedilla", "onesuperior", "masculine", "guillemotright", "onequarter", "onehalf", "threequarters",
+    "questiondown",
+    "Agrave", "Aacute", "Acircumflex", "Atilde", "Adiaeresis", "Aring", "AE", "Ccedilla",
+    "Egrave", "Eacute", "Ecircumflex", "Ediaeresis", "Igrave", "Iacute", "Icircumflex", "Idiaeresis",
+    "ETH", "Ntilde", "Ograve", "Oacute", "Ocircumflex", "Otilde", "Odiaeresis", "multiply",
+    "Ooblique", "Ugrave", "Uacute", "Ucircumflex", "Udiaeresis", "Yacute", "THORN", "ssharp",
+    "agrave", "aacute", "acircumflex", "atilde", "adiaeresis", "aring", "ae", "ccedilla",
+    "egrave", "eacute", "ecircumflex", "ediaeresis", "igrave", "iacute", "icircumflex", "idiaeresis",
+    "eth", "ntilde", "ograve", "oacute", "ocircumflex", "otilde", "odiaeresis", "division",
+    "oslash", "ugrave", "uacute", "ucircumflex", "udiaeresis", "yacute", "thorn", "ydiaeresis",
+};
+
+static const std::vector<std::pair<int, std::vector<std::string>>> symbol_tables = {
+    {KT_SPEC, {"VoidSymbol", "Return", "Show_Registers", "Show_Memory", "Show_State", "Break", "Last_Console",
+               "Caps_Lock", "Num_Lock", "Scroll_Lock", "Scroll_Forward", "Scroll_Backward", "Boot", "Caps_On",
+               "Compose", "SAK", "Decr_Console", "Incr_Console", "KeyboardSignal", "Bare_Num_Lock"}},
+    {KT_PAD, {"KP_0", "KP_1", "KP_2", "KP_3", "KP_4", "KP_5", "KP_6", "KP_7", "KP_8", "KP_9", "KP_Add",
+              "KP_Subtract", "KP_Multiply", "KP_Divide", "KP_Enter", "KP_Comma", "KP_Period", "KP_MinPlus"}},
+    {KT_DEAD, {"dead_grave", "dead_acute", "dead_circumflex", "dead_tilde", "dead_diaeresis", "dead_cedilla"}},
+    {KT_CUR, {"Down", "Left", "Right", "Up"}},
+    {KT_SHIFT, {"Shift", "AltGr", "Control", "Alt", "ShiftL", "ShiftR", "CtrlL", "CtrlR", "CapsShift"}},
+    {KT_ASCII, {"Ascii_0", "Ascii_1", "Ascii_2", "Ascii_3", "Ascii_4", "Ascii_5", "Ascii_6", "Ascii_7",
+                "Ascii_8", "Ascii_9", "Hex_0", "Hex_1", "Hex_2", "Hex_3", "Hex_4", "Hex_5", "Hex_6", "Hex_7",
+                "Hex_8", "Hex_9", "Hex_A", "Hex_B", "Hex_C", "Hex_D", "Hex_E", "Hex_F"}},
+    {KT_LOCK, {"Shift_Lock", "AltGr_Lock", "Control_Lock", "Alt_Lock", "ShiftL_Lock", "ShiftR_Lock",
+               "CtrlL_Lock", "CtrlR_Lock", "CapsShift_Lock"}},
+    {KT_SLOCK, {"SShift", "SAltGr", "SControl", "SAlt", "SShiftL", "SShiftR", "SCtrlL", "SCtrlR", "SCapsShift"}},
+};
+
+static const std::map<std::string, std::string> synonyms = {
+    {"Control_h", "BackSpace"}, {"Control_i", "Tab"}, {"Control_j", "Linefeed"}, {"Home", "Find"},
+    {"End", "Select"}, {"PageUp", "Prior"}, {"PageDown", "Next"}, {"multiplication", "multiply"},
+    {"pound", "sterling"}, {"pilcrow", "paragraph"}, {"Oslash", "Ooblique"}, {"Shift_L", "ShiftL"},
+    {"Shift_R", "ShiftR"}, {"Control_L", "CtrlL"}, {"Control_R", "CtrlR"}, {"AltL", "Alt"}, {"AltR", "AltGr"},
+    {"Alt_L", "Alt"}, {"Alt_R", "AltGr"}, {"AltGr_L", "Alt"}, {"AltGr_R", "AltGr"}, {"AltLLock", "Alt_Lock"},
+    {"AltRLock", "AltGr_Lock"}, {"SCtrl", "SControl"}, {"Spawn_Console", "KeyboardSignal"},
+    {"Uncaps_Shift", "CapsShift"}, {"tilde", "asciitilde"}, {"circumflex", "asciicircum"},
+    {"dead_ogonek", "dead_cedilla"}, {"dead_caron", "dead_circumflex"}, {"dead_breve", "dead_tilde"},
+    {"dead_doublegrave", "dead_grave"}, {"no-break_space", "nobreakspace"}, {"paragraph_sign", "section"},
+    {"soft_hyphen", "hyphen"}, {"bullet", "periodcentered"}, {"rightanglequote", "guillemotright"},
+    {"leftanglequote", "guillemotleft"}, {"quoteright", "apostrophe"}, {"quoteleft", "grave"},
+};
+
+static const std::map<std::string, int> modifier_names = {
+    {"plain", 0}, {"shift", 1 << KG_SHIFT}, {"altgr", 1 << KG_ALTGR}, {"control", 1 << KG_CTRL},
+    {"alt", 1 << KG_ALT}, {"shiftl", 1 << KG_SHIFTL}, {"shiftr", 1 << KG_SHIFTR}, {"ctrll", 1 << KG_CTRLL},
+    {"ctrlr", 1 << KG_CTRLR}, {"capsshift", 1 << KG_CAPSSHIFT},
+};
+
+static const std::map<std::string, uint16_t>& symbol_names() {
+    static const std::map<std::string, uint16_t> names = [] {
+        std::map<std::string, uint16_t> table;
+        for (int i = 0; i < 256; i++) {
+            if (!*latin_names[i]) continue;
+            table[latin_names[i]] = i < 0x80 ? K(KT_LATIN, i) : static_cast<uint16_t>(i ^ 0xf000);
+            if (i < 0x80) table[std::string("Meta_") + latin_names[i]] = K(KT_META, i);
+        }
+        for (const auto& [type, names] : symbol_tables) {
+            for (size_t i = 0; i < names.size(); i++) {
+                table[names[i]] = K(type, i);
+            }
+        }
+        for (int i = 0; i < 20; i++) table["F" + std::to_string(i + 1)] = K(KT_FN, i);
+        const char* editing[] = {"Find", "Insert", "Remove", "Select", "Prior", "Next", "Macro", "Help", "Do", "Pause"};
+        for (int i = 0; i < 10; i++) table[editing[i]] = K(KT_FN, 20 + i);
+        for (int i = 21; i <= 245; i++) table["F" + std::to_string(i)] = K(KT_FN, i + 9);
+        for (int i = 1; i <= 63; i++) table["Console_" + std::to_string(i)] = K(KT_CONS, i - 1);
+        for (const auto& [alias, name] : synonyms) {
+            if (table.count(name)) table[alias] = table[name];
+        }
+        return table;
+    }();
+    return names;
+}
+
+static std::vector<std::string> tokenize(const std::string& line) {
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < line.size()) {
+        char c = line[i];
+        if (isspace(static_cast<unsigned char>(c)) || c == ',') {
+            i++;
+        } else if (c == '#' || c == '!') {
+            break;
+        } else if (c == '=') {
+            tokens.push_back("=");
+            i++;
+        } else if (c == '"' || c == '\'') {
+            size_t end = i + 1;
+            while (end < line.size() && line[end] != c) {
+                if (line[end] == '\\') end++;
+                end++;
+            }
+            tokens.push_back(line.substr(i, end + 1 - i));
+            i = end + 1;
+        } else {
+            size_t end = i;
+            while (end < line.size() && !isspace(static_cast<unsigned char>(line[end])) && line[end] != '=' &&
+                   line[end] != ',') {
+                end++;
+            }
+            tokens.push_back(line.substr(i, end - i));
+            i = end;
+        }
+    }
+    return tokens;
+}
+
+static std::string unquote(const std::string& token) {
+    std::string out;
+    for (size_t i = 1; i + 1 < token.size(); i++) {
+        if (token[i] != '\\' || i + 2 >= token.size()) {
+            out += token[i];
+            continue;
+        }
+        char c = token[++i];
+        if (c == 'n') {
+            out += '\n';
+        } else if (c >= '0' && c <= '7') {
+            int value = 0;
+            for (int n = 0; n < 3 && i + 1 < token.size() && token[i] >= '0' && token[i] <= '7'; n++) {
+                value = value * 8 + (token[i++] - '0');
+            }
+            i--;
+            out += static_cast<char>(value);
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+Keymap::Keymap(const std::vector<fs::path>& dirs) : roots(dirs), keymaps_seen(false), alt_is_meta(false) {
+}
+
+fs::path Keymap::find_keymap(const std::string& name) const {
+    for (const auto& root : roots) {
+        if (!fs::is_directory(root)) continue;
+        for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::follow_directory_symlink)) {
+            std::string file = entry.path().filename().string();
+            if (file.compare(0, name.size() + 4, name + ".map") == 0 &&
+                (file.size() == name.size() + 4 || file[name.size() + 4] == '.')) {
+                return entry.path();
+            }
+        }
+    }
+    return "";
+}
+
+fs::path Keymap::find_include(const std::string& name, const fs::path& from) const {
+    std::vector<fs::path> dirs;
+    for (fs::path dir = from.parent_path(); !dir.empty(); dir = dir.parent_path()) {
+        dirs.push_back(dir);
+        dirs.push_back(dir / "include");
+        bool at_root = std::find(roots.begin(), roots.end(), dir) != roots.end();
+        if (at_root || dir == dir.root_path()) break;
+    }
+    for (const auto& dir : dirs) {
+        for (const char* ext : {"", ".inc", ".map"}) {
+            for (const char* comp : {"", ".gz", ".xz", ".zst", ".bz2"}) {
+                fs::path candidate = dir / (name + ext + comp);
+                if (fs::is_regular_file(candidate)) return candidate;
+            }
+        }
+    }
+    return "";
+}
+
+void Keymap::load(const std::string& name) {
+    fs::path path = name.find('/') != std::string::npos ? fs::path(name) : find_keymap(name);
+    if (path.empty() || !fs::is_regular_file(path)) {
+        throw std::runtime_error(":: [!] keymap not found: " + name);
+    }
+    parse_file(path);
+    expand_constants();
+}
+
+void Keymap::parse_file(const fs::path& path) {
+    if (loading.count(path)) {
+        problems.push_back("include loop at " + path.string());
+        return;
+    }
+    loading.insert(path);
+
+    std::string ext = path.extension().string();
+    std::string text;
+    if (ext == ".gz" || ext == ".xz" || ext == ".zst" || ext == ".bz2") {
+        std::string tool = ext == ".gz" ? "gzip" : ext == ".xz" ? "xz" : ext == ".zst" ? "zstd" : "bzip2";
+        std::string cmd = tool + " -d -c '" + path.string() + "' 2>/dev/null";
+        FILE* pipe = popen(cmd.c_str(), "r");
+        if (pipe) {
+            char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) text.append(buffer, n);
+            pclose(pipe);
+        }
+    } else {
+        std::ifstream in(path);
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        text = ss.str();
+    }
+
+    std::istringstream lines(text);
+    std::string line, logical;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\\') {
+            logical += line.substr(0, line.size() - 1) + " ";
+            continue;
+        }
+        parse_line(logical + line, path);
+        logical.clear();
+    }
+    loading.erase(path);
+}
+
+bool Keymap::symbol(const std::string& token, uint16_t& value) {
+    if (token.empty()) return false;
+    if (token[0] == '+' && token.size() > 1) {
+        if (!symbol(token.substr(1), value)) return false;
+        if ((value >> 8) == KT_LATIN) value = K(KT_LETTER, value & 0xff);
+        return true;
+    }
+    if (token.compare(0, 2, "U+") == 0) {
+        unsigned long code = std::strtoul(token.c_str() + 2, nullptr, 16);
+        value = code < 0x80 ? K(KT_LATIN, code) : static_cast<uint16_t>(code ^ 0xf000);
+        return true;
+    }
+    if (isdigit(static_cast<unsigned char>(token[0]))) {
+        value = static_cast<uint16_t>(std::strtoul(token.c_str(), nullptr, 0));
+        return true;
+    }
+    if (token.size() == 3 && token[0] == '\'' && token[2] == '\'') {
+        value = K(KT_LATIN, static_cast<unsigned char>(token[1]));
+        return true;
+    }
+    const auto& names = symbol_names();
+    auto it = names.find(token);
+    if (it == names.end()) return false;
+    value = it->second;
+    return true;
+}
+
+void Keymap::parse_line(const std::string& line, const fs::path& path) {
+    std::vector<std::string> tokens = tokenize(line);
+    if (tokens.empty()) return;
+    const std::string& first = tokens[0];
+
+    if (first == "include" && tokens.size() > 1) {
+        fs::path inc = find_include(unquote(tokens[1]), path);
+        if (inc.empty()) {
+            problems.push_back("include not found: " + unquote(tokens[1]));
+        } else {
+            parse_file(inc);
+        }
+        return;
+    }
+    if (first == "keymaps") {
+        columns.clear();
+        keymaps_seen = true;
+        for (size_t i = 1; i < tokens.size(); i++) {
+            size_t dash = tokens[i].find('-');
+            int lo = std::atoi(tokens[i].c_str());
+            int hi = dash == std::string::npos ? lo : std::atoi(tokens[i].c_str() + dash + 1);
+            for (int map = lo; map <= hi && map < 256; map++) columns.push_back(map);
+        }
+        return;
+    }
+    if (first == "alt_is_meta") {
+        alt_is_meta = true;
+        return;
+    }
+    if (first == "string" && tokens.size() >= 4 && tokens[2] == "=") {
+        uint16_t value;
+        if (symbol(tokens[1], value) && (value >> 8) == KT_FN) {
+            strings[value & 0xff] = unquote(tokens[3]);
+        } else {
+            problems.push_back("unknown string key: " + tokens[1]);
+        }
+        return;
+    }
+    if (first == "charset" || first == "strings" || first == "compose") {
+        return;
+    }
+
+    int map = 0;
+    size_t pos = 0;
+    bool modified = false;
+    while (pos < tokens.size() && modifier_names.count(tokens[pos])) {
+        map |= modifier_names.at(tokens[pos++]);
+        modified = true;
+    }
+    if (pos + 2 >= tokens.size() || tokens[pos] != "keycode" || tokens[pos + 2] != "=") {
+        problems.push_back("unrecognized line in " + path.filename().string() + ": " + line);
+        return;
+    }
+    int keycode = std::atoi(tokens[pos + 1].c_str());
+    if (keycode < 0 || keycode > 255) return;
+
+    std::vector<uint16_t> values;
+    for (size_t i = pos + 3; i < tokens.size(); i++) {
+        uint16_t value = K(KT_SPEC, 0);
+        if (!symbol(tokens[i], value)) {
+            problems.push_back("unknown symbol: " + tokens[i]);
+            value = K(KT_SPEC, 0);
+        }
+        values.push_back(value);
+    }
+    if (values.empty()) return;
+
+    if (modified) {
+        entries[{map, keycode}] = values[0];
+        return;
+    }
+    if (values.size() == 1) {
+        uint16_t value = values[0];
+        if ((value >> 8) == KT_LATIN && isalpha(value & 0xff)) value = K(KT_LETTER, value & 0xff);
+        constants[keycode] = value;
+        entries[{0, keycode}] = value;
+        return;
+    }
+    constants.erase(keycode);
+    for (size_t i = 0; i < values.size(); i++) {
+        int table = keymaps_seen ? (i < columns.size() ? columns[i] : -1) : static_cast<int>(i);
+        if (table >= 0) entries[{table, keycode}] = values[i];
+    }
+}
+
+void Keymap::expand_constants() {
+    std::set<int> tables;
+    if (keymaps_seen) {
+        tables.insert(columns.begin(), columns.end());
+    } else {
+        for (const auto& [key, value] : entries) tables.insert(key.first);
+    }
+    const int shift = (1 << KG_SHIFT) | (1 << KG_SHIFTL) | (1 << KG_SHIFTR);
+    const int ctrl = (1 << KG_CTRL) | (1 << KG_CTRLL) | (1 << KG_CTRLR);
+
+    for (const auto& [keycode, value] : constants) {
+        for (int table : tables) {
+            if (table == 0 || entries.count({table, keycode})) continue;
+            uint16_t v = value;
+            if ((value >> 8) == KT_LETTER) {
+                int c = value & 0xff;
+                c = (table & shift) ? toupper(c) : tolower(c);
+                if (table & ctrl) c &= 0x1f;
+                if (table & (1 << KG_ALT)) {
+                    v = K(KT_META, c);
+                } else {
+                    v = K((table & ctrl) ? KT_LATIN : KT_LETTER, c);
+                }
+            }
+            entries[{table, keycode}] = v;
+        }
+    }
+
+    if (!alt_is_meta) return;
+    for (int table : tables) {
+        if (!(table & (1 << KG_ALT))) continue;
+        int base = table & ~(1 << KG_ALT);
+        for (int keycode = 0; keycode < 256; keycode++) {
+            auto it = entries.find({base, keycode});
+            if (it == entries.end() || entries.count({table, keycode})) continue;
+            int type = it->second >> 8;
+            int c = it->second & 0xff;
+            if ((type == KT_LATIN || type == KT_LETTER) && c < 0x80) {
+                entries[{table, keycode}] = K(KT_META, c);
+            }
+        }
+    }
+}
+
+void Keymap::write(const fs::path& output) const {
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write keymap: " + output.string());
+    }
+    auto put16 = [&out](uint16_t value) {
+        char bytes[2] = {static_cast<char>(value & 0xff), static_cast<char>(value >> 8)};
+        out.write(bytes, 2);
+    };
+    out.write("NKM1", 4);
+    put16(entries.size());
+    for (const auto& [key, value] : entries) {
+        out.put(static_cast<char>(key.first));
+        out.put(static_cast<char>(key.second));
+        put16(value);
+    }
+    put16(strings.size());
+    for (const auto& [func, text] : strings) {
+        std::string s = text.substr(0, 255);
+        out.put(static_cast<char>(func));
+        out.put(static_cast<char>(s.size()));
+        out.write(s.data(), s.size());
+    }
+}
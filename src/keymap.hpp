@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class Keymap {
+public:
+    explicit Keymap(const std::vector<fs::path>& roots);
+
+    void load(const std::string& name);
+    void write(const fs::path& output) const;
+    size_t entry_count() const { return entries.size(); }
+    const std::vector<std::string>& warnings() const { return problems; }
+
+private:
+    std::vector<fs::path> roots;
+    std::map<std::pair<int, int>, uint16_t> entries;
+    std::map<int, uint16_t> constants;
+    std::map<int, std::string> strings;
+    std::vector<int> columns;
+    bool keymaps_seen;
+    bool alt_is_meta;
+    std::set<fs::path> loading;
+    std::vector<std::string> problems;
+
+    fs::path find_keymap(const std::string& name) const;
+    fs::path find_include(const std::string& name, const fs::path& from) const;
+    void parse_file(const fs::path& path);
+    void parse_line(const std::string& line, const fs::path& path);
+    bool symbol(const std::string& token, uint16_t& value);
+    void expand_constants();
+};
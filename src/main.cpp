@@ -5,12 +5,18 @@
 #include <string>
 #include <map>
 #include <algorithm>
+#include <thread>
+#include <mutex>
 #include <cstdlib>
+#include <cstring>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "config.hpp"
 #include "generator.hpp"
 #include "hooks.hpp"
+#include "cache.hpp"
+#include "watch.hpp"
+#include "inspect.hpp"
 #include "utils.hpp"
 namespace fs = std::filesystem;
 void print_version() {
@@ -24,16 +30,132 @@ void print_usage(const char* prog) {
     std::cout << "  -o, --output FILE    Output initramfs file" << std::endl;
     std::cout << "  -c, --config FILE    Configuration file" << std::endl;
     std::cout << "  -k, --kernel VER     Kernel version" << std::endl;
+    std::cout << "  -r, --root DIR       Build from an offline target tree (repeatable)" << std::endl;
+    std::cout << "      --watch          Rebuild images in the background on changes" << std::endl;
+    std::cout << "      --wait           Wait for the watch daemon to finish pending builds" << std::endl;
+    std::cout << "      --timeout SEC    Give up waiting after SEC seconds" << std::endl;
+    std::cout << "  -j, --jobs N         Stage files with N parallel jobs (default: all CPUs)" << std::endl;
+    std::cout << "      --report FILE    Write a size report grouped by origin" << std::endl;
+    std::cout << "      --uki FILE       Also write a unified kernel image (EFI stub + kernel + initramfs)" << std::endl;
+    std::cout << "      --cpio-list FILE Keep the staged tree and write a gen_init_cpio list for it" << std::endl;
+    std::cout << "      --profile FILE   Trim the image to the usage recorded in FILE (repeatable)" << std::endl;
+    std::cout << "      --list FILE      List the contents of an image" << std::endl;
+    std::cout << "      --extract FILE   Extract an image into the -o directory (default: .)" << std::endl;
+    std::cout << "      --verify FILE    Check module dependencies and libraries in an image" << std::endl;
     std::cout << "  -v, --verbose        Verbose output" << std::endl;
     std::cout << "  -h, --help           Show this help" << std::endl;
     std::cout << "      --version        Show version" << std::endl;
 }
 
+static std::string latest_kernel(const fs::path& root) {
+    std::vector<std::string> versions;
+    fs::path mod_dir = root / "usr/lib/modules";
+    if (fs::is_directory(mod_dir)) {
+        for (const auto& entry : fs::directory_iterator(mod_dir)) {
+            if (entry.is_directory()) versions.push_back(entry.path().filename().string());
+        }
+    }
+    if (versions.empty()) {
+        throw std::runtime_error(":: [!] no kernel modules found in " + mod_dir.string());
+    }
+    std::sort(versions.begin(), versions.end(), [](const std::string& a, const std::string& b) {
+        return strverscmp(a.c_str(), b.c_str()) < 0;
+    });
+    return versions.back();
+}
+
+struct Extras {
+    std::string report;
+    std::string uki;
+    std::string cpio_list;
+    std::vector<std::string> profiles;
+
+    Extras under(const fs::path& root) const {
+        auto relocate = [&root](const std::string& path) {
+            return path.empty() ? path : (root / fs::path(path).relative_path()).string();
+        };
+        std::vector<std::string> relocated;
+        for (const auto& profile : profiles) {
+            relocated.push_back(relocate(profile));
+        }
+        return {relocate(report), relocate(uki), relocate(cpio_list), relocated};
+    }
+};
+
+// Generator errors already carry the ":: [!] " prefix; library ones do not.
+static std::string error_text(const std::exception& e) {
+    std::string text = e.what();
+    return text.compare(0, 7, ":: [!] ") == 0 ? text.substr(7) : text;
+}
+
+static void build(const Config& cfg, const std::string& kernel_version, const std::string& output_file,
+                  bool verbose, int jobs, const Extras& extras, const fs::path& root = "/",
+                  FileCache* cache = nullptr) {
+    Generator gen(cfg, kernel_version, verbose, root, cache);
+    if (!extras.report.empty()) {
+        gen.enable_report(extras.report);
+    }
+    if (!extras.uki.empty()) {
+        gen.enable_uki(extras.uki);
+    }
+    if (!extras.cpio_list.empty()) {
+        gen.enable_cpio_list(extras.cpio_list);
+    }
+    if (!extras.profiles.empty()) {
+        gen.enable_trim(extras.profiles);
+    }
+    gen.create_structure();
+    gen.build(output_file, jobs);
+}
+
+static int build_roots(const std::vector<std::string>& roots, const std::string& config_file,
+                       const std::string& kernel_version, const std::string& output_file, bool verbose, int jobs,
+                       const Extras& extras) {
+    FileCache cache;
+    std::mutex log_mutex;
+    int failed = 0;
+    std::vector<std::thread> workers;
+    for (const auto& root_dir : roots) {
+        workers.emplace_back([&, root_dir] {
+            fs::path root = fs::absolute(root_dir);
+            std::string output = (root / fs::path(output_file).relative_path()).string();
+            try {
+                std::string kver = kernel_version.empty() ? latest_kernel(root) : kernel_version;
+                Config cfg(config_file.empty() ? (root / "etc/nullinitrd/config").string() : config_file);
+                {
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    std::cout << ":: root " << root.string() << ": linux " << kver << " -> " << output << std::endl;
+                }
+                build(cfg, kver, output, verbose, jobs, extras.under(root), root, &cache);
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << ":: initramfs generated successfully: " << output << std::endl;
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << ":: [!] " << root.string() << ": " << error_text(e) << std::endl;
+                failed++;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return failed == 0 ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
     std::string output_file;
-    std::string config_file = "/etc/nullinitrd/config";
+    std::string config_file;
     std::string kernel_version;
+    Extras extras;
+    std::string inspect_mode;
+    std::string inspect_image;
+    std::vector<std::string> roots;
     bool verbose = false;
+    bool watch = false;
+    bool wait = false;
+    int timeout = 0;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    utils::catch_sigpipe();
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "-h" || arg == "--help") {
@@ -50,33 +172,89 @@ int main(int argc, char* argv[]) {
             config_file = argv[++i];
         } else if ((arg == "-k" || arg == "--kernel") && i + 1 < argc) {
             kernel_version = argv[++i];
+        } else if ((arg == "-r" || arg == "--root") && i + 1 < argc) {
+            roots.push_back(argv[++i]);
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--wait") {
+            wait = true;
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            timeout = std::atoi(argv[++i]);
+        } else if ((arg == "--list" || arg == "--extract" || arg == "--verify") && i + 1 < argc) {
+            inspect_mode = arg;
+            inspect_image = argv[++i];
+        } else if (arg == "--report" && i + 1 < argc) {
+            extras.report = argv[++i];
+        } else if (arg == "--uki" && i + 1 < argc) {
+            extras.uki = argv[++i];
+        } else if (arg == "--cpio-list" && i + 1 < argc) {
+            extras.cpio_list = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            extras.profiles.push_back(argv[++i]);
+        } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            jobs = std::max(1, std::atoi(argv[++i]));
         }
     }
 
-    if (kernel_version.empty()) {
-        kernel_version = utils::get_kernel_version();
+    if (wait) {
+        return Watcher::wait(timeout);
+    }
+
+    if (!inspect_mode.empty()) {
+        try {
+            if (inspect_mode == "--list") return inspect::list(inspect_image);
+            if (inspect_mode == "--extract") return inspect::extract(inspect_image, output_file.empty() ? "." : output_file);
+            return inspect::verify(inspect_image);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (watch) {
+        if (config_file.empty()) {
+            config_file = "/etc/nullinitrd/config";
+        }
+        Watcher watcher(config_file, output_file.empty() ? "/boot/initrd.img-%k" : output_file, 2000, verbose);
+        return watcher.run([&](const std::string& kver, const std::string& output) {
+            Config cfg(config_file);
+            build(cfg, kver, output, verbose, jobs, extras);
+            return true;
+        });
     }
+
     if (output_file.empty()) {
         output_file = "/boot/initrd.img";
     }
 
+    if (!roots.empty()) {
+        std::cout << ":: nullinitrd" << std::endl;
+        std::cout << ":: building " << roots.size() << " target tree(s)..." << std::endl;
+        try {
+            return build_roots(roots, config_file, kernel_version, output_file, verbose, jobs, extras);
+        } catch (const std::exception& e) {
+            std::cerr << ":: [!] " << error_text(e) << std::endl;
+            return 1;
+        }
+    }
+
+    if (kernel_version.empty()) {
+        kernel_version = utils::get_kernel_version();
+    }
+    if (config_file.empty()) {
+        config_file = "/etc/nullinitrd/config";
+    }
+
     std::cout << ":: nullinitrd" << std::endl;
     std::cout << ":: linux " << kernel_version << std::endl;
     std::cout << ":: output -> " << output_file << std::endl;
     std::cout << ":: building initramfs..." << std::endl;
     try {
         Config cfg(config_file);
-        Generator gen(cfg, kernel_version, verbose);
-        gen.create_structure();
-        gen.copy_binaries();
-        gen.copy_libraries();
-        gen.copy_modules();
-        gen.create_init();
-        gen.run_hooks();
-        gen.pack(output_file);
+        build(cfg, kernel_version, output_file, verbose, jobs, extras);
         std::cout << ":: initramfs generated successfully: " << output_file << std::endl;
     } catch (const std::exception& e) {
-        std::cerr << ":: [!] " << e.what() << std::endl;
+        std::cerr << ":: [!] " << error_text(e) << std::endl;
         return 1;
     }
 
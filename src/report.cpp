@@ -0,0 +1,223 @@
+#include "report.hpp"
+#include "tasks.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static unsigned long long compressed_size(const std::vector<fs::path>& files, const std::string& cmd) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0) return 0;
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        close(in[0]);
+        close(in[1]);
+        return 0;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return 0;
+    }
+
+    bool broken = false;
+    std::thread feeder([&files, &broken, fd = in[1]] {
+        char buffer[1 << 16];
+        for (const auto& file : files) {
+            int src = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (src < 0) continue;
+            ssize_t n;
+            while (!broken && (n = read(src, buffer, sizeof(buffer))) > 0) {
+                broken = write(fd, buffer, n) != n;
+            }
+            close(src);
+        }
+        close(fd);
+    });
+
+    unsigned long long total = 0;
+    char buffer[1 << 16];
+    ssize_t n;
+    while ((n = read(out[0], buffer, sizeof(buffer))) > 0) {
+        total += n;
+    }
+    feeder.join();
+    close(out[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (broken || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error(":: [!] failed to estimate compressed size with: " + cmd);
+    }
+    return total;
+}
+
+static std::string group_key(const Report::Origin& origin) {
+    return origin.name.empty() ? origin.kind : origin.kind + " " + origin.name;
+}
+
+static std::string signed_bytes(long long delta) {
+    return (delta >= 0 ? "+" : "") + std::to_string(delta);
+}
+
+void Report::record(const fs::path& path, const Origin& origin) {
+    std::lock_guard<std::mutex> lock(mutex);
+    origins.emplace(path.string(), origin);
+    if (origin.kind == "binary") binaries[path.string()].insert(origin.name);
+}
+
+Report::Snapshot Report::snapshot(const fs::path& root) const {
+    Snapshot files;
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        struct stat st;
+        if (lstat(entry.path().c_str(), &st) < 0 || S_ISDIR(st.st_mode)) continue;
+        files[entry.path().string()] = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    return files;
+}
+
+void Report::record_changes(const fs::path& root, const Snapshot& before, const Origin& origin) {
+    Snapshot after = snapshot(root);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [path, mtime] : after) {
+        auto it = before.find(path);
+        if (it == before.end() || it->second != mtime) {
+            hook_origins.emplace(path, origin);
+        }
+    }
+}
+
+void Report::collect(const fs::path& root, const std::string& compress_cmd, int jobs) {
+    groups.clear();
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        struct stat st;
+        if (lstat(entry.path().c_str(), &st) < 0 || S_ISDIR(st.st_mode)) continue;
+
+        std::string path = entry.path().string();
+        Origin origin = {"other", "", ""};
+        auto users = binaries.find(path);
+        if (users != binaries.end() && users->second.size() > 1) {
+            std::string names;
+            for (const auto& name : users->second) names += (names.empty() ? "" : ",") + name;
+            origin = {"shared", names, ""};
+        } else if (origins.count(path)) {
+            origin = origins[path];
+        } else if (hook_origins.count(path)) {
+            origin = hook_origins[path];
+        }
+
+        Group& group = groups[group_key(origin)];
+        group.origin = origin;
+        unsigned long long size = S_ISLNK(st.st_mode) ? fs::read_symlink(entry.path()).string().size() : st.st_size;
+        group.files.emplace_back(entry.path().lexically_relative(root).string(), size);
+        group.raw += size;
+        if (S_ISREG(st.st_mode)) {
+            group.contents.push_back(entry.path());
+        }
+    }
+
+    TaskGraph graph;
+    for (auto& [key, group] : groups) {
+        if (group.contents.empty()) continue;
+        Group* g = &group;
+        graph.add([g, &compress_cmd] { g->compressed = compressed_size(g->contents, compress_cmd); });
+    }
+    graph.run(jobs);
+}
+
+void Report::write(const std::string& path, unsigned long long image_size) {
+    std::map<std::string, std::pair<unsigned long long, unsigned long long>> previous;
+    std::ifstream old(path);
+    std::string line;
+    while (std::getline(old, line)) {
+        if (line.compare(0, 6, "group ") != 0) continue;
+        std::map<std::string, std::string> fields;
+        std::istringstream iss(line.substr(6));
+        std::string field;
+        while (iss >> field) {
+            size_t eq = field.find('=');
+            if (eq != std::string::npos) fields[field.substr(0, eq)] = field.substr(eq + 1);
+        }
+        Origin origin = {fields["kind"], fields["name"], ""};
+        previous[group_key(origin)] = {std::strtoull(fields["raw"].c_str(), nullptr, 10),
+                                       std::strtoull(fields["compressed"].c_str(), nullptr, 10)};
+    }
+    old.close();
+    bool has_previous = !previous.empty();
+
+    std::vector<const Group*> sorted;
+    unsigned long long total_raw = 0, total_compressed = 0, total_files = 0;
+    for (const auto& [key, group] : groups) {
+        sorted.push_back(&group);
+        total_raw += group.raw;
+        total_compressed += group.compressed;
+        total_files += group.files.size();
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Group* a, const Group* b) {
+        return a->compressed != b->compressed ? a->compressed > b->compressed : a->raw > b->raw;
+    });
+
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write report: " + path);
+    }
+    out << "total files=" << total_files << " raw=" << total_raw << " compressed=" << total_compressed
+        << " image=" << image_size << "\n";
+
+    std::vector<std::pair<long long, std::string>> changes;
+    for (const Group* group : sorted) {
+        std::string key = group_key(group->origin);
+        out << "group kind=" << group->origin.kind;
+        if (!group->origin.name.empty()) out << " name=" << group->origin.name;
+        if (!group->origin.reason.empty()) out << " reason=" << group->origin.reason;
+        out << " files=" << group->files.size() << " raw=" << group->raw << " compressed=" << group->compressed;
+
+        auto it = previous.find(key);
+        if (it == previous.end()) {
+            if (has_previous) {
+                out << " new";
+                changes.emplace_back(group->compressed, key + " (new)");
+            }
+        } else {
+            long long delta_raw = (long long)group->raw - (long long)it->second.first;
+            long long delta = (long long)group->compressed - (long long)it->second.second;
+            out << " delta_raw=" << signed_bytes(delta_raw) << " delta_compressed=" << signed_bytes(delta);
+            if (delta_raw != 0 || delta != 0) changes.emplace_back(delta, key);
+            previous.erase(it);
+        }
+        out << "\n";
+        for (const auto& [file, size] : group->files) {
+            out << "  " << file << " " << size << "\n";
+        }
+    }
+    for (const auto& [key, sizes] : previous) {
+        out << "removed " << key << " raw=" << sizes.first << " compressed=" << sizes.second << "\n";
+        changes.emplace_back(-(long long)sizes.second, key + " (removed)");
+    }
+
+    std::cout << ":: report -> " << path << std::endl;
+    std::cout << ":: " << total_files << " files, " << total_raw << " bytes raw, at most "
+              << total_compressed << " bytes compressed group by group, " << image_size << " bytes in the image"
+              << std::endl;
+    std::sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) {
+        return std::llabs(a.first) > std::llabs(b.first);
+    });
+    for (size_t i = 0; i < changes.size() && i < 10; i++) {
+        std::cout << "::   " << signed_bytes(changes[i].first) << " " << changes[i].second << std::endl;
+    }
+}
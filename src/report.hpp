@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class Report {
+public:
+    struct Origin {
+        std::string kind;
+        std::string name;
+        std::string reason;
+    };
+    using Snapshot = std::map<std::string, long long>;
+
+    void record(const fs::path& path, const Origin& origin);
+    Snapshot snapshot(const fs::path& root) const;
+    void record_changes(const fs::path& root, const Snapshot& before, const Origin& origin);
+    void collect(const fs::path& root, const std::string& compress_cmd, int jobs);
+    void write(const std::string& path, unsigned long long image_size);
+
+private:
+    struct Group {
+        Origin origin;
+        std::vector<std::pair<std::string, unsigned long long>> files;
+        unsigned long long raw = 0;
+        unsigned long long compressed = 0;
+        std::vector<fs::path> contents;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Origin> origins;
+    std::map<std::string, Origin> hook_origins;
+    std::map<std::string, std::set<std::string>> binaries;
+    std::map<std::string, Group> groups;
+};
@@ -0,0 +1,179 @@
+#include "sysroot.hpp"
+#include <fstream>
+#include <deque>
+#include <set>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+const char ld_cache_magic[] = "glibc-ld.so.cache1.1";
+
+struct LdCacheHeader {
+    char magic[20];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t pad[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+};
+
+struct LdCacheEntry {
+    int32_t flags;
+    uint32_t key;
+    uint32_t value;
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+void replace_all(std::string& s, const std::string& from, const std::string& to) {
+    for (size_t pos = s.find(from); pos != std::string::npos; pos = s.find(from, pos + to.size())) {
+        s.replace(pos, from.size(), to);
+    }
+}
+
+}
+
+Sysroot::Sysroot(const fs::path& dir)
+    : root(dir.empty() ? fs::path("/") : fs::absolute(dir).lexically_normal()),
+      ld_cache_loaded(false) {
+    if (!root.has_filename() && root != "/") {
+        root = root.parent_path();
+    }
+}
+
+bool Sysroot::is_host() const {
+    return root == "/";
+}
+
+const fs::path& Sysroot::dir() const {
+    return root;
+}
+
+fs::path Sysroot::path(const std::string& target_path) const {
+    if (is_host()) return target_path;
+    return root / fs::path(target_path).relative_path();
+}
+
+fs::path Sysroot::resolve(const fs::path& host_path) const {
+    if (is_host()) {
+        std::error_code ec;
+        fs::path real = fs::weakly_canonical(host_path, ec);
+        return ec ? host_path : real;
+    }
+    fs::path rel = host_path.lexically_relative(root);
+    if (rel.empty() || *rel.begin() == "..") return host_path;
+
+    std::deque<fs::path> pending(rel.begin(), rel.end());
+    fs::path current;
+    int hops = 0;
+    while (!pending.empty()) {
+        fs::path comp = pending.front();
+        pending.pop_front();
+        if (comp == "." || comp.empty()) continue;
+        if (comp == "..") {
+            current = current.parent_path();
+            continue;
+        }
+        fs::path candidate = current / comp;
+        if (fs::is_symlink(root / candidate) && hops++ < 40) {
+            fs::path target = fs::read_symlink(root / candidate);
+            if (target.is_absolute()) {
+                current.clear();
+                target = target.relative_path();
+            }
+            pending.insert(pending.begin(), target.begin(), target.end());
+        } else {
+            current = candidate;
+        }
+    }
+    return root / current;
+}
+
+void Sysroot::load_ld_cache() {
+    ld_cache_loaded = true;
+    std::ifstream file(path("/etc/ld.so.cache"), std::ios::binary);
+    if (!file) return;
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t base = data.find(ld_cache_magic);
+    if (base == std::string::npos || data.size() < base + sizeof(LdCacheHeader)) return;
+    LdCacheHeader hdr;
+    memcpy(&hdr, data.data() + base, sizeof(hdr));
+
+    size_t entries = base + sizeof(LdCacheHeader);
+    for (uint32_t i = 0; i < hdr.nlibs; i++) {
+        size_t off = entries + i * sizeof(LdCacheEntry);
+        if (off + sizeof(LdCacheEntry) > data.size()) break;
+        LdCacheEntry entry;
+        memcpy(&entry, data.data() + off, sizeof(entry));
+        if (base + entry.key >= data.size() || base + entry.value >= data.size()) continue;
+        ld_cache.emplace(data.c_str() + base + entry.key, data.c_str() + base + entry.value);
+    }
+}
+
+bool Sysroot::matches(const fs::path& candidate, const elf::Info& info) const {
+    auto lib = elf::read(resolve(candidate));
+    return lib.valid && lib.is64 == info.is64 && lib.machine == info.machine;
+}
+
+std::string Sysroot::find_library(const std::string& name, const fs::path& origin, const elf::Info& info) {
+    if (name.find('/') != std::string::npos) {
+        fs::path p = path(name);
+        return fs::exists(resolve(p)) ? p.string() : "";
+    }
+
+    for (auto dir : info.runpath) {
+        replace_all(dir, "${ORIGIN}", origin.string());
+        replace_all(dir, "$ORIGIN", origin.string());
+        fs::path p = path(dir) / name;
+        if (matches(p, info)) return p.string();
+    }
+
+    if (!ld_cache_loaded) load_ld_cache();
+    auto range = ld_cache.equal_range(name);
+    for (auto it = range.first; it != range.second; ++it) {
+        fs::path p = path(it->second);
+        if (matches(p, info)) return p.string();
+    }
+
+    std::vector<std::string> dirs = {"/lib", "/usr/lib"};
+    if (info.is64) dirs.insert(dirs.begin(), {"/lib64", "/usr/lib64"});
+    for (const auto& dir : dirs) {
+        fs::path p = path(dir) / name;
+        if (matches(p, info)) return p.string();
+    }
+    return "";
+}
+
+std::vector<std::string> Sysroot::get_dependencies(const std::string& binary) {
+    std::vector<std::string> deps;
+    auto info = elf::read(resolve(binary));
+    if (!info.valid) return deps;
+
+    std::set<std::string> seen;
+    std::deque<std::pair<fs::path, elf::Info>> queue;
+    queue.emplace_back(binary, info);
+    if (!info.interpreter.empty()) {
+        std::string interp = path(info.interpreter).string();
+        if (fs::exists(resolve(interp))) {
+            deps.push_back(interp);
+            seen.insert(interp);
+        }
+    }
+
+    while (!queue.empty()) {
+        auto [obj, obj_info] = queue.front();
+        queue.pop_front();
+        fs::path origin = "/" / obj.lexically_relative(root).parent_path();
+        for (const auto& name : obj_info.needed) {
+            std::string lib = find_library(name, origin, obj_info);
+            if (lib.empty() || seen.count(lib)) continue;
+            seen.insert(lib);
+            deps.push_back(lib);
+            queue.emplace_back(lib, elf::read(resolve(lib)));
+        }
+    }
+    return deps;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include "elf.hpp"
+
+namespace fs = std::filesystem;
+
+class Sysroot {
+public:
+    Sysroot(const fs::path& dir = "/");
+
+    bool is_host() const;
+    const fs::path& dir() const;
+    fs::path path(const std::string& target_path) const;
+    fs::path resolve(const fs::path& host_path) const;
+    std::vector<std::string> get_dependencies(const std::string& binary);
+
+private:
+    fs::path root;
+    bool ld_cache_loaded;
+    std::multimap<std::string, std::string> ld_cache;
+
+    void load_ld_cache();
+    std::string find_library(const std::string& name, const fs::path& origin, const elf::Info& info);
+    bool matches(const fs::path& candidate, const elf::Info& info) const;
+};
@@ -0,0 +1,112 @@
+#include "tasks.hpp"
+#include <thread>
+#include <algorithm>
+
+TaskGraph::Id TaskGraph::add(std::function<void()> fn, const std::vector<Id>& deps) {
+    Id id = tasks.size();
+    tasks.push_back(std::make_unique<Task>());
+    tasks[id]->fn = std::move(fn);
+    tasks[id]->waiting = deps.size();
+    for (Id dep : deps) {
+        tasks[dep]->successors.push_back(id);
+    }
+    return id;
+}
+
+void TaskGraph::push(size_t worker, Id id) {
+    {
+        std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+        workers[worker]->queue.push_back(id);
+    }
+    queued++;
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    idle_cv.notify_one();
+}
+
+bool TaskGraph::pop(size_t worker, Id& id) {
+    {
+        auto& own = *workers[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.queue.empty()) {
+            id = own.queue.back();
+            own.queue.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        auto& victim = *workers[(worker + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.queue.empty()) {
+            id = victim.queue.front();
+            victim.queue.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskGraph::complete(size_t worker, Id id) {
+    for (Id next : tasks[id]->successors) {
+        if (--tasks[next]->waiting == 0) {
+            push(worker, next);
+        }
+    }
+    if (--remaining == 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_cv.notify_all();
+    }
+}
+
+void TaskGraph::work(size_t worker) {
+    while (remaining > 0 && !failed) {
+        Id id;
+        if (!pop(worker, id)) {
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle_cv.wait(lock, [this] { return queued > 0 || remaining == 0 || failed; });
+            continue;
+        }
+        try {
+            tasks[id]->fn();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            if (!failed) error = std::current_exception();
+            failed = true;
+            idle_cv.notify_all();
+            return;
+        }
+        complete(worker, id);
+    }
+}
+
+void TaskGraph::run(int jobs) {
+    if (tasks.empty()) return;
+    size_t n = std::max(1, jobs);
+    workers.clear();
+    for (size_t i = 0; i < n; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    remaining = tasks.size();
+    queued = 0;
+    failed = false;
+
+    size_t next = 0;
+    for (Id id = 0; id < tasks.size(); id++) {
+        if (tasks[id]->waiting == 0) {
+            push(next++ % n, id);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n; i++) {
+        threads.emplace_back(&TaskGraph::work, this, i);
+    }
+    work(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
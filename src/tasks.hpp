@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+class TaskGraph {
+public:
+    using Id = size_t;
+
+    Id add(std::function<void()> fn, const std::vector<Id>& deps = {});
+    void run(int jobs);
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        std::vector<Id> successors;
+        std::atomic<size_t> waiting{0};
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Id> queue;
+    };
+
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+    std::atomic<size_t> remaining{0};
+    std::atomic<size_t> queued{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+
+    void push(size_t worker, Id id);
+    bool pop(size_t worker, Id& id);
+    void work(size_t worker);
+    void complete(size_t worker, Id id);
+};
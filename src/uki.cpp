@@ -0,0 +1,174 @@
+#include "uki.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+static const size_t SECTION_HEADER_SIZE = 40;
+static const uint32_t SECTION_FLAGS = 0x40000040;
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+UkiWriter::UkiWriter(const fs::path& stub) {
+    std::ifstream in(stub, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(":: [!] EFI stub not found: " + stub.string());
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    image = ss.str();
+
+    if (image.size() < 0x40 || image.compare(0, 2, "MZ") != 0) {
+        throw std::runtime_error(":: [!] not a PE image: " + stub.string());
+    }
+    pe_offset = get32(0x3c);
+    if (pe_offset + 24 > image.size() || image.compare(pe_offset, 4, std::string("PE\0\0", 4)) != 0) {
+        throw std::runtime_error(":: [!] not a PE image: " + stub.string());
+    }
+    opt_offset = pe_offset + 24;
+    uint16_t magic = get16(opt_offset);
+    if (magic != 0x20b && magic != 0x10b) {
+        throw std::runtime_error(":: [!] unsupported PE optional header in " + stub.string());
+    }
+    pe32plus = magic == 0x20b;
+    table_offset = opt_offset + get16(pe_offset + 20);
+
+    size_t dirs = opt_offset + (pe32plus ? 112 : 96);
+    uint32_t dir_count = get32(opt_offset + (pe32plus ? 108 : 92));
+    if (dir_count > 4) {
+        uint32_t cert_offset = get32(dirs + 4 * 8);
+        uint32_t cert_size = get32(dirs + 4 * 8 + 4);
+        if (cert_size > 0) {
+            std::cerr << ":: [!] EFI stub is signed, dropping its signature; sign the resulting image" << std::endl;
+            if (cert_offset + cert_size >= image.size()) {
+                image.resize(cert_offset);
+            }
+            put32(dirs + 4 * 8, 0);
+            put32(dirs + 4 * 8 + 4, 0);
+        }
+    }
+}
+
+uint32_t UkiWriter::get32(size_t off) const {
+    uint32_t value;
+    memcpy(&value, image.data() + off, sizeof(value));
+    return value;
+}
+
+uint16_t UkiWriter::get16(size_t off) const {
+    uint16_t value;
+    memcpy(&value, image.data() + off, sizeof(value));
+    return value;
+}
+
+void UkiWriter::put32(size_t off, uint32_t value) {
+    memcpy(&image[off], &value, sizeof(value));
+}
+
+void UkiWriter::put16(size_t off, uint16_t value) {
+    memcpy(&image[off], &value, sizeof(value));
+}
+
+void UkiWriter::add_section(const std::string& name, const std::string& data) {
+    sections.push_back({name, data, "", data.size()});
+}
+
+void UkiWriter::add_file(const std::string& name, const fs::path& path) {
+    if (!fs::is_regular_file(path)) {
+        throw std::runtime_error(":: [!] file not found for " + name + ": " + path.string());
+    }
+    sections.push_back({name, "", path, fs::file_size(path)});
+}
+
+void UkiWriter::write(const std::string& output) {
+    uint16_t count = get16(pe_offset + 6);
+    uint32_t section_alignment = get32(opt_offset + 32);
+    uint32_t file_alignment = get32(opt_offset + 36);
+    uint32_t header_size = get32(opt_offset + 60);
+
+    uint64_t next_va = 0;
+    uint64_t next_raw = image.size();
+    size_t first_raw = image.size();
+    for (uint16_t i = 0; i < count; i++) {
+        size_t hdr = table_offset + i * SECTION_HEADER_SIZE;
+        std::string name(image.data() + hdr, strnlen(image.data() + hdr, 8));
+        for (const auto& section : sections) {
+            if (section.name == name) {
+                throw std::runtime_error(":: [!] EFI stub already has a " + name + " section");
+            }
+        }
+        uint32_t vsize = get32(hdr + 8), va = get32(hdr + 12), raw_size = get32(hdr + 16), raw = get32(hdr + 20);
+        next_va = std::max<uint64_t>(next_va, align_up(va + std::max(vsize, raw_size), section_alignment));
+        next_raw = std::max<uint64_t>(next_raw, raw + raw_size);
+        if (raw_size > 0) first_raw = std::min<size_t>(first_raw, raw);
+    }
+
+    size_t table_end = table_offset + (count + sections.size()) * SECTION_HEADER_SIZE;
+    if (table_end > header_size || table_end > first_raw) {
+        throw std::runtime_error(":: [!] EFI stub has no room for " + std::to_string(sections.size()) +
+                                 " more section headers");
+    }
+
+    std::vector<uint64_t> offsets;
+    uint32_t initialized = get32(opt_offset + 8);
+    next_raw = align_up(next_raw, file_alignment);
+    for (size_t i = 0; i < sections.size(); i++) {
+        const Section& section = sections[i];
+        uint64_t raw_size = align_up(section.size, file_alignment);
+        if (next_va + section.size > UINT32_MAX || next_raw + raw_size > UINT32_MAX) {
+            throw std::runtime_error(":: [!] unified kernel image would exceed 4 GiB");
+        }
+        size_t hdr = table_offset + (count + i) * SECTION_HEADER_SIZE;
+        memset(&image[hdr], 0, SECTION_HEADER_SIZE);
+        memcpy(&image[hdr], section.name.data(), std::min<size_t>(section.name.size(), 8));
+        put32(hdr + 8, section.size);
+        put32(hdr + 12, next_va);
+        put32(hdr + 16, raw_size);
+        put32(hdr + 20, next_raw);
+        put32(hdr + 36, SECTION_FLAGS);
+
+        offsets.push_back(next_raw);
+        initialized += raw_size;
+        next_va = align_up(next_va + section.size, section_alignment);
+        next_raw += raw_size;
+    }
+    put16(pe_offset + 6, count + sections.size());
+    put32(opt_offset + 8, initialized);
+    put32(opt_offset + 56, next_va);
+    put32(opt_offset + 64, 0);
+
+    std::string tmp = output + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error(":: [!] cannot write " + output);
+    }
+    out.write(image.data(), image.size());
+    uint64_t pos = image.size();
+    std::vector<char> buffer(1 << 16);
+    for (size_t i = 0; i < sections.size(); i++) {
+        const Section& section = sections[i];
+        std::string pad(offsets[i] - pos, '\0');
+        out.write(pad.data(), pad.size());
+        if (section.file.empty()) {
+            out.write(section.data.data(), section.data.size());
+        } else {
+            std::ifstream in(section.file, std::ios::binary);
+            while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+                out.write(buffer.data(), in.gcount());
+            }
+        }
+        pos = offsets[i] + section.size;
+    }
+    std::string pad(align_up(pos, file_alignment) - pos, '\0');
+    out.write(pad.data(), pad.size());
+    out.close();
+    if (!out) {
+        fs::remove(tmp);
+        throw std::runtime_error(":: [!] failed to write " + output);
+    }
+    fs::rename(tmp, output);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class UkiWriter {
+public:
+    explicit UkiWriter(const fs::path& stub);
+
+    void add_section(const std::string& name, const std::string& data);
+    void add_file(const std::string& name, const fs::path& path);
+    void write(const std::string& output);
+
+private:
+    struct Section {
+        std::string name;
+        std::string data;
+        fs::path file;
+        uint64_t size;
+    };
+
+    std::string image;
+    std::vector<Section> sections;
+    size_t pe_offset;
+    size_t opt_offset;
+    size_t table_offset;
+    bool pe32plus;
+
+    uint32_t get32(size_t off) const;
+    uint16_t get16(size_t off) const;
+    void put32(size_t off, uint32_t value);
+    void put16(size_t off, uint16_t value);
+};
@@ -1,6 +1,9 @@
 #include "utils.hpp"
 #include <cstdio>
 #include <array>
+#include <fstream>
+#include <cstdint>
+#include <csignal>
 #include <sys/utsname.h>
 namespace utils {
 std::string get_kernel_version() {
@@ -29,4 +32,32 @@ std::string execute_command(const std::string& cmd) {
     return result;
 }
 
+std::string file_digest(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    uint64_t hash = 1469598103934665603ULL;
+    uint64_t size = 0;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ULL;
+        }
+        size += file.gcount();
+    }
+    char out[40];
+    snprintf(out, sizeof(out), "%016llx-%llu", (unsigned long long)hash, (unsigned long long)size);
+    return out;
+}
+
+static void on_sigpipe(int) {
+}
+
+// A compressor that dies early must surface as EPIPE on our writes, not kill
+// the generator. A handler rather than SIG_IGN, so exec'd children get the
+// default disposition back.
+void catch_sigpipe() {
+    struct sigaction sa = {};
+    sa.sa_handler = on_sigpipe;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, nullptr);
+}
 }
@@ -5,4 +5,6 @@ namespace utils {
     std::string get_kernel_version();
     bool command_exists(const std::string& cmd);
     std::string execute_command(const std::string& cmd);
+    std::string file_digest(const std::string& path);
+    void catch_sigpipe();
 }
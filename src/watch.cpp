@@ -0,0 +1,364 @@
+#include "watch.hpp"
+#include "config.hpp"
+#include "generator.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* run_dir = "/run/nullinitrd";
+const char* modules_dir = "/usr/lib/modules";
+
+const int ioprio_who_process = 1;
+const int ioprio_class_idle = 3;
+const int ioprio_class_shift = 13;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_signal(int) {
+    stop_requested = 1;
+}
+
+fs::path pid_file() {
+    return fs::path(run_dir) / "watch.pid";
+}
+
+pid_t running_daemon() {
+    std::ifstream f(pid_file());
+    pid_t pid = 0;
+    if (!(f >> pid) || pid <= 0) return 0;
+    return kill(pid, 0) == 0 ? pid : 0;
+}
+
+bool commit_file(const fs::path& tmp, const fs::path& dst) {
+    int fd = open(tmp.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), dst.c_str()) != 0) return false;
+    int dir = open(dst.parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
+
+}
+
+Watcher::Watcher(const std::string& config, const std::string& pattern, int debounce, bool v)
+    : config_file(config), output_pattern(pattern), debounce_ms(debounce), verbose(v),
+      inotify_fd(-1), builder_pid(0), last_ok(true) {}
+
+Watcher::~Watcher() {
+    if (inotify_fd >= 0) close(inotify_fd);
+}
+
+void Watcher::add_watch(WatchKind kind, const std::string& path, uint32_t mask) {
+    int wd = inotify_add_watch(inotify_fd, path.c_str(), mask);
+    if (wd < 0) {
+        if (verbose) {
+            std::cerr << ":: [?] cannot watch " << path << ": " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+    if (verbose) {
+        std::cout << ":: watching " << path << std::endl;
+    }
+    watches[wd] = {kind, path};
+}
+
+void Watcher::load_tracked_binaries() {
+    tracked_binaries.clear();
+    try {
+        Config cfg(config_file);
+        for (const auto& bin : Generator::required_binaries(cfg)) {
+            tracked_binaries.insert(bin);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void Watcher::setup_watches() {
+    const uint32_t file_events = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+    add_watch(WatchKind::Modules, modules_dir, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+    for (const auto& kver : installed_kernels()) {
+        add_watch(WatchKind::Kernel, std::string(modules_dir) + "/" + kver, file_events | IN_ONLYDIR);
+    }
+    add_watch(WatchKind::Config, fs::path(config_file).parent_path().string(), file_events);
+    for (const char* dir : {"/etc/nullinitrd/hooks", "/usr/share/nullinitrd/hooks", "/usr/local/share/nullinitrd/hooks"}) {
+        if (fs::is_directory(dir)) add_watch(WatchKind::Hooks, dir, file_events);
+    }
+    for (const char* dir : {"/usr/local/sbin", "/usr/local/bin", "/usr/sbin", "/usr/bin", "/sbin", "/bin"}) {
+        if (fs::is_directory(dir)) add_watch(WatchKind::Binaries, dir, file_events);
+    }
+    add_watch(WatchKind::Control, run_dir, IN_CREATE | IN_MOVED_TO);
+}
+
+std::vector<std::string> Watcher::installed_kernels() const {
+    std::vector<std::string> kernels;
+    if (!fs::is_directory(modules_dir)) return kernels;
+    for (const auto& entry : fs::directory_iterator(modules_dir)) {
+        if (entry.is_directory()) kernels.push_back(entry.path().filename().string());
+    }
+    return kernels;
+}
+
+void Watcher::mark_all() {
+    for (const auto& kver : installed_kernels()) {
+        pending.insert(kver);
+    }
+}
+
+void Watcher::handle_events() {
+    alignas(struct inotify_event) char buffer[8192];
+    ssize_t len;
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            auto* ev = (struct inotify_event*)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                mark_all();
+                continue;
+            }
+            auto it = watches.find(ev->wd);
+            if (it == watches.end()) continue;
+            if (ev->mask & IN_IGNORED) {
+                watches.erase(it);
+                continue;
+            }
+            std::string name = ev->len ? ev->name : "";
+            const auto& [kind, path] = it->second;
+
+            switch (kind) {
+            case WatchKind::Modules:
+                if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    pending.erase(name);
+                } else {
+                    add_watch(WatchKind::Kernel, path + "/" + name,
+                              IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+                    pending.insert(name);
+                }
+                break;
+            case WatchKind::Kernel:
+                pending.insert(fs::path(path).filename().string());
+                break;
+            case WatchKind::Config:
+                if (name == fs::path(config_file).filename()) {
+                    load_tracked_binaries();
+                    mark_all();
+                }
+                break;
+            case WatchKind::Hooks:
+                mark_all();
+                break;
+            case WatchKind::Binaries:
+                if (tracked_binaries.count(name)) mark_all();
+                break;
+            case WatchKind::Control:
+                if (name.compare(0, 5, "wait.") == 0) waiters.push_back(name);
+                break;
+            }
+            if (verbose && !name.empty() && kind != WatchKind::Control) {
+                std::cout << ":: changed: " << path << "/" << name << std::endl;
+            }
+        }
+    }
+}
+
+std::string Watcher::output_for(const std::string& kernel_version) const {
+    std::string out = output_pattern;
+    for (size_t pos = out.find("%k"); pos != std::string::npos; pos = out.find("%k", pos + kernel_version.size())) {
+        out.replace(pos, 2, kernel_version);
+    }
+    return out;
+}
+
+bool Watcher::ambiguous_output() const {
+    return output_pattern.find("%k") == std::string::npos && installed_kernels().size() > 1;
+}
+
+void Watcher::start_build(const Builder& build) {
+    std::vector<std::string> kernels(pending.begin(), pending.end());
+    pending.clear();
+    if (ambiguous_output()) {
+        std::cerr << ":: [!] not rebuilding: -o needs %k when more than one kernel is installed" << std::endl;
+        last_ok = false;
+        return;
+    }
+    std::cout << ":: rebuilding " << kernels.size() << " image(s)..." << std::endl;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << ":: [!] fork failed: " << strerror(errno) << std::endl;
+        pending.insert(kernels.begin(), kernels.end());
+        return;
+    }
+    if (pid > 0) {
+        builder_pid = pid;
+        return;
+    }
+
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift);
+    bool ok = true;
+    for (const auto& kver : kernels) {
+        if (!fs::is_directory(fs::path(modules_dir) / kver)) continue;
+        std::string output = output_for(kver);
+        std::string tmp = output + ".tmp";
+        try {
+            if (build(kver, tmp) && commit_file(tmp, output)) {
+                std::cout << ":: initramfs generated successfully: " << output << std::endl;
+                continue;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << ":: [!] " << e.what() << std::endl;
+        }
+        std::cerr << ":: [!] failed to rebuild " << output << std::endl;
+        unlink(tmp.c_str());
+        ok = false;
+    }
+    _exit(ok ? 0 : 1);
+}
+
+void Watcher::finish_build(int status) {
+    builder_pid = 0;
+    last_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!last_ok) {
+        std::cerr << ":: [!] background rebuild failed" << std::endl;
+    }
+}
+
+void Watcher::answer_waiters() {
+    for (const auto& name : waiters) {
+        fs::path wait_path = fs::path(run_dir) / name;
+        fs::path done_path = fs::path(run_dir) / ("done." + name.substr(5));
+        std::ofstream(wait_path) << (last_ok ? "ok" : "failed") << "\n";
+        rename(wait_path.c_str(), done_path.c_str());
+    }
+    waiters.clear();
+}
+
+int Watcher::run(const Builder& build) {
+    if (running_daemon()) {
+        std::cerr << ":: [!] watch daemon already running" << std::endl;
+        return 1;
+    }
+    if (ambiguous_output()) {
+        std::cerr << ":: [!] -o needs %k when more than one kernel is installed" << std::endl;
+        return 1;
+    }
+    fs::create_directories(run_dir);
+    std::ofstream(pid_file()) << getpid() << "\n";
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        std::cerr << ":: [!] inotify_init failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    load_tracked_binaries();
+    setup_watches();
+
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    std::cout << ":: watching for changes (output: " << output_pattern << ")" << std::endl;
+    auto last_event = std::chrono::steady_clock::now();
+    while (!stop_requested) {
+        int timeout = -1;
+        if (builder_pid > 0) {
+            timeout = 200;
+        } else if (!pending.empty()) {
+            auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - last_event).count();
+            timeout = waiters.empty() ? std::max<long>(0, debounce_ms - quiet) : 0;
+        }
+
+        struct pollfd pfd = {inotify_fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeout);
+        if (ret < 0 && errno != EINTR) break;
+        if (ret > 0) {
+            handle_events();
+            last_event = std::chrono::steady_clock::now();
+        }
+
+        if (builder_pid > 0) {
+            int status;
+            if (waitpid(builder_pid, &status, WNOHANG) == builder_pid) {
+                finish_build(status);
+            }
+        }
+        if (builder_pid == 0 && !pending.empty()) {
+            auto quiet = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - last_event).count();
+            if (!waiters.empty() || quiet >= debounce_ms) {
+                start_build(build);
+            }
+        }
+        if (builder_pid == 0 && pending.empty() && !waiters.empty()) {
+            answer_waiters();
+        }
+    }
+
+    if (builder_pid > 0) {
+        int status;
+        waitpid(builder_pid, &status, 0);
+        finish_build(status);
+    }
+    answer_waiters();
+    fs::remove(pid_file());
+    std::cout << ":: watch stopped" << std::endl;
+    return 0;
+}
+
+int Watcher::wait(int timeout_s) {
+    pid_t daemon = running_daemon();
+    if (!daemon) {
+        std::cerr << ":: [!] watch daemon not running" << std::endl;
+        return 2;
+    }
+
+    std::string id = std::to_string(getpid());
+    fs::path wait_path = fs::path(run_dir) / ("wait." + id);
+    fs::path done_path = fs::path(run_dir) / ("done." + id);
+    std::ofstream(wait_path).close();
+
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        if (fs::exists(done_path)) {
+            std::string status;
+            std::ifstream(done_path) >> status;
+            fs::remove(done_path);
+            return status == "ok" ? 0 : 1;
+        }
+        if (kill(daemon, 0) != 0) {
+            fs::remove(wait_path);
+            std::cerr << ":: [!] watch daemon exited" << std::endl;
+            return 2;
+        }
+        if (timeout_s > 0 && std::chrono::steady_clock::now() - start > std::chrono::seconds(timeout_s)) {
+            fs::remove(wait_path);
+            std::cerr << ":: [!] timed out waiting for watch daemon" << std::endl;
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+
+enum class WatchKind { Modules, Kernel, Config, Hooks, Binaries, Control };
+
+class Watcher {
+public:
+    using Builder = std::function<bool(const std::string& kernel_version, const std::string& output)>;
+
+    Watcher(const std::string& config_file, const std::string& output_pattern,
+            int debounce_ms, bool verbose);
+    ~Watcher();
+
+    int run(const Builder& build);
+    static int wait(int timeout_s);
+
+private:
+    std::string config_file;
+    std::string output_pattern;
+    int debounce_ms;
+    bool verbose;
+    int inotify_fd;
+    std::map<int, std::pair<WatchKind, std::string>> watches;
+    std::set<std::string> tracked_binaries;
+    std::set<std::string> pending;
+    std::vector<std::string> waiters;
+    pid_t builder_pid;
+    bool last_ok;
+
+    void add_watch(WatchKind kind, const std::string& path, uint32_t mask);
+    void setup_watches();
+    void load_tracked_binaries();
+    std::vector<std::string> installed_kernels() const;
+    bool ambiguous_output() const;
+    void mark_all();
+    void handle_events();
+    void start_build(const Builder& build);
+    void finish_build(int status);
+    void answer_waiters();
+    std::string output_for(const std::string& kernel_version) const;
+};